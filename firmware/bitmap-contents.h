@@ -4,17 +4,28 @@
 #include <cstdint>
 #include <cstdlib>
 
-// Make writing bitmaps a bit more readable.
-constexpr uint64_t operator""_bitmap(const char *str, size_t) {
-  uint64_t result = 0;
+#include "panel-row.h"
+
+using BitmapRow = RowBitsFor<kPanelCount>;
+
+// Make writing bitmaps a bit more readable. The row is read as a binary
+// number across all panels, so bitmaps narrower than the tape end up on the
+// right.
+constexpr BitmapRow operator""_bitmap(const char *str, size_t) {
+  constexpr int kWords = kRowWords<BitmapRow>;
+  BitmapRow result{};
   for (/**/; *str; ++str) {
-    result |= (*str != ' ');
-    result <<= static_cast<uint64_t>(1);
+    RowWord(result, kWords - 1) |= (*str != ' ');
+    for (int w = 0; w < kWords; ++w) {  // Shift left by one.
+      uint64_t &word = RowWord(result, w);
+      word <<= 1;
+      if (w + 1 < kWords) word |= RowWord(result, w + 1) >> 63;
+    }
   }
   return result;
 }
 
-constexpr uint64_t kJollyWrencherBitmap[] = {
+constexpr BitmapRow kJollyWrencherBitmap[] = {
     "                                                                "_bitmap,
     "       #####                                      #####         "_bitmap,
     "        ######                                  ######          "_bitmap,
@@ -72,7 +83,7 @@ constexpr uint64_t kJollyWrencherBitmap[] = {
     "       #####                                      #####         "_bitmap,
 };
 
-constexpr uint64_t kProjectQRBitmap[] = {
+constexpr BitmapRow kProjectQRBitmap[] = {
     "##############  ########  ##        ##############       "_bitmap,
     "##############  ########  ##        ##############       "_bitmap,
     "##          ##  ##    ##  ##    ##  ##          ##       "_bitmap,
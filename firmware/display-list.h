@@ -0,0 +1,187 @@
+#ifndef DISPLAY_LIST_H
+#define DISPLAY_LIST_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "glyph-font.h"
+#include "panel-row.h"
+
+// Image described by a short list of what it shows instead of drawn pixel by
+// pixel: runs of text, each with its font and position, and bitmaps. Row()
+// draws a single row of it, so the rows can be drawn one by one just before
+// they go out (see FrameBuffer::StartDisplayList()): nothing to render before
+// the pull starts, and the memory needed is the same for any image length.
+//
+// Each row draws every item covering it, so this is for content of a few
+// items; the glyphs of a text are looked up again for each row.
+template <int kPanels>
+class BasicDisplayList {
+ public:
+  using RowBits_t = RowBitsFor<kPanels>;
+  static constexpr int kMaxItems = 8;
+  static constexpr int kMaxText = 24;  // Including the terminating '\0'.
+
+  void Clear(ScreenAspect type) {
+    aspect_type_ = type;
+    count_ = 0;
+  }
+
+  ScreenAspect aspect() const { return aspect_type_; }
+
+  // Text starting at (x, y), or ending there if right_aligned, as drawn by
+  // WriteText(). Returns false if the list is full. Text longer than
+  // kMaxText - 1 characters is cut.
+  bool AddText(const GlyphFont &font, int x, int y, const char *text,
+               bool right_aligned = false, int extra_space = 0) {
+    if (count_ == kMaxItems) return false;
+    Item &item = items_[count_++];
+    item = Item{};
+    item.font = &font;
+    item.x = x;
+    item.y = y;
+    item.extra_space = extra_space;
+    item.right_aligned = right_aligned;
+    SetText(&item, text);
+    return true;
+  }
+
+  // Bitmap rows, e.g. kProjectQRBitmap, starting at image row y. They are
+  // not copied, so they need to stay around while printing.
+  bool AddBitmap(const RowBits_t *bitmap, int rows, int y) {
+    if (count_ == kMaxItems) return false;
+    Item &item = items_[count_++];
+    item = Item{};
+    item.bitmap = bitmap;
+    item.begin = y;
+    item.end = y + rows;
+    return true;
+  }
+  template <size_t N>
+  bool AddBitmap(const RowBits_t (&bitmap)[N], int y = 0) {
+    return AddBitmap(bitmap, N, y);
+  }
+
+  // Rows of the image: up to the last one covered by any item.
+  int rows() const {
+    int result = 0;
+    for (int i = 0; i < count_; ++i) result = std::max(result, items_[i].end);
+    return result;
+  }
+
+  // Row r of the image, the same as when drawn on a FrameBuffer.
+  RowBits_t Row(int r) const {
+    RowBits_t result{};
+    for (int i = 0; i < count_; ++i) {
+      const Item &item = items_[i];
+      if (r < item.begin || r >= item.end) continue;
+      if (item.bitmap) {
+        result |= item.bitmap[r - item.begin];
+      } else if (aspect_type_ == ScreenAspect::kAlongLength) {
+        TextColumn(item, r, &result);
+      } else {
+        TextScanline(item, r, &result);
+      }
+    }
+    return result;
+  }
+
+ private:
+  struct Item {
+    const GlyphFont *font;    // Text; nullptr for a bitmap.
+    const RowBits_t *bitmap;  // Bitmap; nullptr for text.
+    int x;
+    int y;
+    int x_begin;  // Left end of the text.
+    int extra_space;
+    bool right_aligned;
+    int begin;  // Rows covered: [begin, end).
+    int end;
+    char text[kMaxText];
+  };
+
+  // Set the text of an item and the rows it covers.
+  void SetText(Item *out, const char *text) {
+    Item &item = *out;
+    int length = 0;
+    for (/**/; text[length] && length < kMaxText - 1; ++length) {
+      item.text[length] = text[length];
+    }
+    item.text[length] = '\0';
+    const GlyphFont &font = *item.font;
+    const int width = TextWidth(font, item.text, item.extra_space);
+    item.x_begin = item.right_aligned ? item.x - width : item.x;
+
+    // Rows covered by the glyphs.
+    int glyphs_end = item.x_begin;  // End of the last glyph.
+    bool any = false;
+    int x = item.x_begin;
+    for (const char *txt = item.text; *txt; ++txt) {
+      if (const Glyph *glyph = font.Find(*txt)) {
+        x += glyph->width;
+        glyphs_end = x;
+        any = true;
+      }
+      x += item.extra_space;
+    }
+    if (!any) {
+      item.begin = item.end = 0;
+    } else if (aspect_type_ == ScreenAspect::kAlongLength) {
+      item.begin = item.x_begin;
+      item.end = glyphs_end;
+    } else {
+      item.begin = item.y;
+      item.end = item.y + font.height;
+    }
+  }
+
+  // Row r as scanline r - y of the glyphs of an item along the width.
+  void TextScanline(const Item &item, int r, RowBits_t *out) const {
+    const GlyphFont &font = *item.font;
+    const int gy = r - item.y;
+    int x = item.x_begin;
+    for (const char *txt = item.text; *txt; ++txt) {
+      if (const Glyph *glyph = font.Find(*txt)) {
+        const uint64_t *scanline =
+            font.bits + glyph->scanlines + gy * font.words_per_scanline;
+        for (int word = 0; word < font.words_per_scanline; ++word) {
+          Place(x + 64 * word, r, scanline[word], out);
+        }
+        x += glyph->width;
+      }
+      x += item.extra_space;
+    }
+  }
+
+  // Row r as the glyph column at x = r of an item along the length.
+  void TextColumn(const Item &item, int r, RowBits_t *out) const {
+    const GlyphFont &font = *item.font;
+    int x = item.x_begin;
+    for (const char *txt = item.text; *txt && x <= r; ++txt) {
+      if (const Glyph *glyph = font.Find(*txt)) {
+        if (r < x + glyph->width) {
+          const uint64_t *column =
+              font.bits + glyph->columns + (r - x) * font.words_per_column;
+          for (int word = 0; word < font.words_per_column; ++word) {
+            Place(r, item.y + 64 * word, column[word], out);
+          }
+        }
+        x += glyph->width;
+      }
+      x += item.extra_space;
+    }
+  }
+
+  void Place(int x, int y, uint64_t bits, RowBits_t *out) const {
+    int row = 0;
+    RowBits_t placed{};
+    if (AlongRow(aspect_type_, x, y, bits, &row, &placed)) *out |= placed;
+  }
+
+  ScreenAspect aspect_type_ = ScreenAspect::kAlongWidth;
+  int count_ = 0;
+  Item items_[kMaxItems] = {};
+};
+
+#endif  // DISPLAY_LIST_H
@@ -0,0 +1,408 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "frame-buffer.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#include "row-store.h"
+
+// Named images kept in a reserved region at the end of flash, so that they
+// survive resets. They are printed right from flash: the RowData of a
+// stored image points into the XIP memory mapped flash, nothing is copied.
+//
+// The region is a circular log of records: an image or a tombstone for a
+// deleted one, each with a sequence number; the newest record of a name
+// wins. Records are appended at the head, which wanders through the whole
+// region, so all sectors wear the same. Ahead of the head, a gap of erased
+// sectors is kept. To grow it, the oldest sector is erased after copying
+// the current images still in it to the head.
+//
+// A record is written data first and its header page last, and only counts
+// if the checksums of header and data are right. So a write interrupted by
+// a power loss leaves the previous state; an image that is moved to the
+// head is only erased after the copy is complete.
+//
+// While erasing or programming, XIP is unavailable, so interrupts and the
+// other core are stalled; erasing a sector takes ~50ms. So the work is
+// done in small steps in Poll(), to be called only while not printing.
+//
+// The other core looks images up with Get() while Poll() changes the
+// directory; a spin lock keeps the two apart. A generation taken before an
+// image was looked up tells if its rows might have been moved since.
+class FlashStore {
+  // "Tlpg"; rows are as wide as the panels, other widths don't match.
+  static constexpr uint32_t kMagic = 0x6770'6c54 + (kPanelCount - 1);
+  static constexpr uint32_t kSectorSize = FLASH_SECTOR_SIZE;
+  static constexpr uint32_t kPageSize = FLASH_PAGE_SIZE;
+
+ public:
+  static constexpr size_t kNameSize = 16;  // Including terminating nul.
+  static constexpr int kMaxImages = 16;
+  static constexpr size_t kMaxDataSize = FrameBuffer::kMaxBytes;
+  static constexpr uint32_t kRegionSize = 512 * 1024;
+  static constexpr uint32_t kRegionOffset =
+      PICO_FLASH_SIZE_BYTES - kRegionSize;
+
+  struct Image {
+    char name[kNameSize];
+    RowData rows;     // Pointing into XIP flash.
+    uint32_t offset;  // Of the record in the region.
+    uint32_t seq;
+  };
+
+  // If core1 runs, it has to call multicore_lockout_victim_init() first.
+  explicit FlashStore(bool lockout_core1)
+      : lockout_core1_(lockout_core1),
+        lock_(spin_lock_instance(spin_lock_claim_unused(true))) {
+    Scan();
+  }
+
+  // Copy of the i-th image; false if there is none. Also from the other
+  // core.
+  bool Get(int i, Image *image) const {
+    const uint32_t irq_state = spin_lock_blocking(lock_);
+    const bool found = i >= 0 && i < count_;
+    if (found) *image = images_[i];
+    spin_unlock(lock_, irq_state);
+    return found;
+  }
+
+  // Number of images. Also from the other core.
+  int size() const {
+    const uint32_t irq_state = spin_lock_blocking(lock_);
+    const int count = count_;
+    spin_unlock(lock_, irq_state);
+    return count;
+  }
+
+  // Changes each time images are added, removed or moved; the rows of an
+  // image are only erased after a change. Also from the other core.
+  uint32_t generation() const {
+    return generation_.load(std::memory_order_acquire);
+  }
+
+  // Store rows under given name, replacing an image of the same name.
+  // Written in Poll(); until then, the rows must not change. Returns false
+  // if another Save() or Delete() is still pending or there is no space.
+  bool Save(const char *name, const RowData &rows) {
+    if (job_pending_ || rows.size > kMaxDataSize) return false;
+    if (Find(name) < 0 && count_ >= kMaxImages) return false;
+    return StartJob(name, rows);
+  }
+
+  // Remove image with the given name. Returns false if not found or busy.
+  bool Delete(const char *name) {
+    if (job_pending_ || Find(name) < 0) return false;
+    return StartJob(name, RowData{nullptr, 0, -1, 0});  // Tombstone
+  }
+
+  // A Save() or Delete() is not written yet.
+  bool busy() const { return job_pending_; }
+
+  // Do the next step of pending work, if any: erase a sector or program a
+  // page. Keeps an erased gap ahead of the head even if there is nothing
+  // else to do, so that a Save() can start right away.
+  void Poll() {
+    if (write_active_) {
+      ProgramNextPage();
+      return;
+    }
+    const uint32_t job_size = job_pending_ ? RecordSize(job_header_) : 0;
+    if (!HasRoom(job_size + kMinErasedGap)) {
+      MakeRoom();
+      return;
+    }
+    if (job_pending_) {
+      StartWrite(job_header_, job_data_);
+      job_pending_ = false;
+    }
+  }
+
+ private:
+  struct Header {
+    uint32_t magic;
+    uint32_t seq;
+    char name[kNameSize];
+    uint32_t data_size;
+    int32_t rows;  // -1: tombstone
+    RowBitsFor<kPanelCount> last_row;
+    uint32_t data_crc;
+    uint32_t header_crc;  // Of all fields above.
+  };
+
+  static constexpr uint32_t kMaxRecordSize =
+      (sizeof(Header) + kMaxDataSize + kPageSize - 1) / kPageSize * kPageSize;
+
+  // Enough to move all records that overlap with the sector to be erased:
+  // the sector full of them, and one reaching in from either side.
+  static constexpr uint32_t kMinErasedGap =
+      (3 * kSectorSize + 2 * kMaxRecordSize - 1) / kSectorSize * kSectorSize;
+  static_assert(2 * kMinErasedGap <= kRegionSize, "Region too small");
+
+  static uint32_t RecordSize(const Header &h) {
+    return (sizeof(Header) + h.data_size + kPageSize - 1) / kPageSize *
+           kPageSize;
+  }
+
+  static const uint8_t *Flash(uint32_t offset) {
+    return reinterpret_cast<const uint8_t *>(XIP_BASE + kRegionOffset +
+                                             offset);
+  }
+
+  static bool IsErased(uint32_t offset, uint32_t size) {
+    const uint8_t *data = Flash(offset);
+    for (uint32_t i = 0; i < size; ++i) {
+      if (data[i] != 0xff) return false;
+    }
+    return true;
+  }
+
+  // Valid record at offset ?
+  static const Header *RecordAt(uint32_t offset) {
+    const Header *h = reinterpret_cast<const Header *>(Flash(offset));
+    if (h->magic != kMagic ||
+        h->header_crc != Crc32(h, offsetof(Header, header_crc)) ||
+        h->data_size > kMaxDataSize ||
+        offset + RecordSize(*h) > kRegionSize ||
+        h->data_crc != Crc32(h + 1, h->data_size)) {
+      return nullptr;
+    }
+    return h;
+  }
+
+  int Find(const char *name) const {
+    for (int i = 0; i < count_; ++i) {
+      if (strncmp(images_[i].name, name, kNameSize) == 0) return i;
+    }
+    return -1;
+  }
+
+  // Update directory with record written at offset.
+  void Apply(const Header &h, uint32_t offset) {
+    const uint32_t irq_state = spin_lock_blocking(lock_);
+    int i = Find(h.name);
+    if (h.rows < 0) {  // Tombstone
+      if (i >= 0) images_[i] = images_[--count_];
+    } else {
+      if (i < 0 && count_ >= kMaxImages) {
+        spin_unlock(lock_, irq_state);
+        return;
+      }
+      if (i < 0) i = count_++;
+      Image &image = images_[i];
+      memcpy(image.name, h.name, kNameSize);
+      image.rows = RowData{Flash(offset) + sizeof(Header), h.data_size,
+                           h.rows, h.last_row};
+      image.offset = offset;
+      image.seq = h.seq;
+    }
+    generation_.fetch_add(1, std::memory_order_release);
+    spin_unlock(lock_, irq_state);
+  }
+
+  // Find all records; recover head and erased gap behind the newest one.
+  void Scan() {
+    // Newest record per name, including tombstones as they might be found
+    // before the older records they hide. Static: too large for the stack.
+    static struct {
+      const Header *header;
+      uint32_t offset;
+    } newest[2 * kMaxImages];
+    int found = 0;
+    const Header *last = nullptr;
+    uint32_t last_offset = 0;
+    for (uint32_t offset = 0; offset < kRegionSize; offset += kPageSize) {
+      const Header *h = RecordAt(offset);
+      if (!h) continue;
+      int i = 0;
+      while (i < found && strncmp(newest[i].header->name, h->name,
+                                  kNameSize) != 0) {
+        ++i;
+      }
+      if (i == found) {
+        if (found < 2 * kMaxImages) newest[found++] = {h, offset};
+      } else if (h->seq > newest[i].header->seq) {
+        newest[i] = {h, offset};
+      }
+      if (!last || h->seq > last->seq) {
+        last = h;
+        last_offset = offset;
+      }
+      offset += RecordSize(*h) - kPageSize;
+    }
+    for (int i = 0; i < found; ++i) {
+      if (newest[i].header->rows >= 0) {
+        Apply(*newest[i].header, newest[i].offset);
+      }
+    }
+
+    head_ = last ? (last_offset + RecordSize(*last)) % kRegionSize : 0;
+    next_seq_ = last ? last->seq + 1 : 1;
+    const uint32_t sector_rest =
+        (kSectorSize - head_ % kSectorSize) % kSectorSize;
+    if (!IsErased(head_, sector_rest)) {
+      // Interrupted write: skip the rest of the sector.
+      head_ = (head_ + sector_rest) % kRegionSize;
+    }
+    // Erased gap, ending at a sector boundary (unless all is erased).
+    gap_ = 0;
+    while (gap_ < kRegionSize &&
+           IsErased((head_ + gap_) % kRegionSize, kPageSize)) {
+      gap_ += kPageSize;
+    }
+    if (gap_ < kRegionSize) gap_ -= (head_ + gap_) % kSectorSize;
+  }
+
+  // Enough erased space for a record of size at the head ? Records don't
+  // wrap around the end of the region.
+  bool HasRoom(uint32_t size) const {
+    const uint32_t skip = head_ + size > kRegionSize ? kRegionSize - head_ : 0;
+    return gap_ >= skip + size;
+  }
+
+  // Grow the erased gap by a sector, or move a current image out of it.
+  void MakeRoom() {
+    const uint32_t sector = (head_ + gap_) % kRegionSize;
+    for (int i = 0; i < count_; ++i) {
+      const Image &image = images_[i];
+      const Header &h = *reinterpret_cast<const Header *>(Flash(image.offset));
+      if (image.offset < sector + kSectorSize &&
+          image.offset + RecordSize(h) > sector) {
+        Header copy = h;
+        copy.seq = next_seq_++;
+        copy.header_crc = Crc32(&copy, offsetof(Header, header_crc));
+        StartWrite(copy, reinterpret_cast<const uint8_t *>(&h + 1));
+        return;
+      }
+    }
+    if (!IsErased(sector, kSectorSize)) {
+      FlashOp([sector]() {
+        flash_range_erase(kRegionOffset + sector, kSectorSize);
+      });
+    }
+    gap_ += kSectorSize;
+  }
+
+  bool StartJob(const char *name, const RowData &rows) {
+    Header &h = job_header_;
+    memset(static_cast<void *>(&h), 0, sizeof(h));  // Padding, for CRC.
+    h.magic = kMagic;
+    snprintf(h.name, kNameSize, "%s", name);
+    h.data_size = rows.size;
+    h.rows = rows.rows;
+    h.last_row = rows.last_row;
+    h.data_crc = Crc32(rows.bytes, rows.size);
+    job_data_ = rows.bytes;
+    job_pending_ = true;
+    return true;
+  }
+
+  void StartWrite(const Header &header, const uint8_t *data) {
+    if (head_ + RecordSize(header) > kRegionSize) {  // Wrap around.
+      gap_ -= kRegionSize - head_;
+      head_ = 0;
+    }
+    write_header_ = header;
+    if (write_header_.seq == 0) {  // New job; moved records keep theirs.
+      write_header_.seq = next_seq_++;
+      write_header_.header_crc =
+          Crc32(&write_header_, offsetof(Header, header_crc));
+    }
+    write_data_ = data;
+    write_pages_ = RecordSize(header) / kPageSize;
+    write_next_page_ = write_pages_ > 1 ? 1 : 0;
+    write_active_ = true;
+  }
+
+  // Data pages first, the page with the header last.
+  void ProgramNextPage() {
+    const uint32_t page = write_next_page_;
+    const uint32_t start = page * kPageSize;  // Within record.
+    memset(page_buffer_, 0xff, sizeof(page_buffer_));
+    for (uint32_t i = 0; i < kPageSize; ++i) {
+      const uint32_t pos = start + i;
+      if (pos < sizeof(Header)) {
+        page_buffer_[i] = reinterpret_cast<uint8_t *>(&write_header_)[pos];
+      } else if (pos - sizeof(Header) < write_header_.data_size) {
+        page_buffer_[i] = write_data_[pos - sizeof(Header)];
+      }
+    }
+    const uint32_t offset = head_ + start;
+    FlashOp([this, offset]() {
+      flash_range_program(kRegionOffset + offset, page_buffer_, kPageSize);
+    });
+    if (page == 0) {  // Done.
+      write_active_ = false;
+      Apply(write_header_, head_);
+      head_ += write_pages_ * kPageSize;
+      gap_ -= write_pages_ * kPageSize;
+      if (head_ >= kRegionSize) head_ = 0;
+      return;
+    }
+    write_next_page_ = (page + 1 < write_pages_) ? page + 1 : 0;
+  }
+
+  // Run flash operation while nothing else runs from flash.
+  template <typename Op>
+  void FlashOp(const Op &op) {
+    if (lockout_core1_) multicore_lockout_start_blocking();
+    const uint32_t irq_state = save_and_disable_interrupts();
+    op();
+    restore_interrupts(irq_state);
+    if (lockout_core1_) multicore_lockout_end_blocking();
+  }
+
+  struct CrcTable {
+    uint32_t entry[256];
+  };
+  static constexpr CrcTable MakeCrcTable() {
+    CrcTable result{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xedb8'8320 : crc >> 1;
+      }
+      result.entry[i] = crc;
+    }
+    return result;
+  }
+
+  static uint32_t Crc32(const void *data, size_t len) {
+    static constexpr CrcTable kTable = MakeCrcTable();
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint32_t crc = 0xffff'ffff;
+    for (size_t i = 0; i < len; ++i) {
+      crc = (crc >> 8) ^ kTable.entry[(crc ^ bytes[i]) & 0xff];
+    }
+    return ~crc;
+  }
+
+  const bool lockout_core1_;
+  spin_lock_t *const lock_;  // Of the directory.
+  Image images_[kMaxImages];
+  int count_ = 0;
+  std::atomic<uint32_t> generation_{0};
+
+  uint32_t head_ = 0;  // Where the next record goes.
+  uint32_t gap_ = 0;   // Erased bytes from head on.
+  uint32_t next_seq_ = 1;
+
+  bool job_pending_ = false;
+  Header job_header_;
+  const uint8_t *job_data_ = nullptr;
+
+  bool write_active_ = false;
+  Header write_header_;
+  const uint8_t *write_data_ = nullptr;
+  uint32_t write_pages_ = 0;
+  uint32_t write_next_page_ = 0;
+  uint8_t page_buffer_[kPageSize];
+};
+#endif
@@ -0,0 +1,475 @@
+#ifndef FRAME_BUFFER_H
+#define FRAME_BUFFER_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+#include "display-list.h"
+#include "panel-row.h"
+#include "row-store.h"
+#include "row-stream.h"
+
+// Image to be printed, one row per encoder tick: 64 bits for each of kPanels
+// Glowxels boards side by side (see panel-row.h).
+//
+// Sequence
+//  StartNewImage();
+//  SetPixel()...
+//  Finalize();  // Optional, otherwise done by FramePrinter::SendStart()
+//
+// Rows are drawn on a canvas that only holds the last kCanvasRows rows of the
+// image; rows further back are converted to the bits as they go out on the
+// wire and stored compressed in a RowEncoder (see row-store.h). So images can
+// be many meters long, as long as they are drawn roughly front to back and
+// compress well. Rows that don't fit into the store anymore are dropped.
+//
+// Static content can be prepared at compile time with Prepare() and used
+// right from flash with UsePrepared(); text e.g. drawn into a RowImage.
+//
+// Content of a few runs of text and bitmaps can instead be described by a
+// display list, see StartDisplayList(): nothing is drawn up front, the
+// printer draws each row just before it goes out (see ListReader).
+//
+// Rows that arrive while printing, in a RowStream_t, go out as they come;
+// see StreamReader.
+//
+// Rows go out on kLanes data lines at once, each a chain of kPanels / kLanes
+// boards; see WireRow().
+template <int kPanels, int kLanes = 1>
+class BasicFrameBuffer {
+  static constexpr int kCanvasRows = 256;  // Power of two.
+  static constexpr uint8_t kEvenOddLineOffset = 4;
+
+ public:
+  using RowBits_t = RowBitsFor<kPanels>;
+  using RowData_t = BasicRowData<RowBits_t>;
+  using DisplayList_t = BasicDisplayList<kPanels>;
+  using RowStream_t = BasicRowStream<RowBits_t>;
+  static constexpr int kColumns = 64 * kPanels;
+  static constexpr size_t kMaxBytes = 5 * 1024 * kPanels;  // Rows stored.
+
+  void StartNewImage(ScreenAspect type) {
+    // Clear out previous image. Rows flushed to the store are zeroed on the
+    // way, so only rows still on the canvas can be set.
+    if (!finalized_) {
+      const int end = std::min(row_end_, canvas_start_ + kCanvasRows);
+      for (int r = canvas_start_; r < end; ++r) {
+        canvas_[r % kCanvasRows] = RowBits_t{};
+      }
+    }
+    for (RowBits_t &row : flushed_) row = RowBits_t{};
+    aspect_type_ = type;
+    canvas_start_ = 0;
+    row_end_ = 0;
+    encoder_.Clear();
+    rows_ = encoder_.data();
+    finalized_ = false;
+    full_ = false;
+    use_list_ = false;
+    drawn_key_ = 0;
+  }
+
+  // Describe the image with the returned display list instead of drawing
+  // it; it is drawn row by row while printing. Pixels can't be set on such
+  // an image. The list must stay unchanged while printing. A non-zero key
+  // names the content, see ReuseDisplayList().
+  DisplayList_t &StartDisplayList(ScreenAspect type, uint32_t key = 0) {
+    StartNewImage(type);
+    list_.Clear(type);
+    list_key_ = key;
+    use_list_ = true;
+    return list_;
+  }
+
+  // Show the display list last started with the same non-zero key again,
+  // instead of describing unchanged content anew, e.g. the clock within a
+  // minute. If its rows were drawn with DrawDisplayList() and finalized,
+  // they are kept as they are. Returns false if there is no such list.
+  bool ReuseDisplayList(uint32_t key) {
+    if (key == 0 || key != list_key_) return false;
+    if (key == drawn_key_ && finalized_) return true;
+    StartNewImage(list_.aspect());
+    use_list_ = true;
+    return true;
+  }
+
+  // Draw the display list into rows now instead, e.g. ahead of time on the
+  // other core: printing stored rows costs less than drawing each one. Before
+  // Finalize().
+  void DrawDisplayList() {
+    if (!use_list_ || finalized_) return;
+    use_list_ = false;
+    const int rows = list_.rows();
+    for (int r = 0; r < rows; ++r) at(r) = list_.Row(r);
+    drawn_key_ = list_key_;
+  }
+
+  // The display list describing the image, nullptr if drawn.
+  const DisplayList_t *display_list() const {
+    return use_list_ ? &list_ : nullptr;
+  }
+
+  // Show rows prepared with Prepare(). They are not copied, so they need to
+  // stay around while printing.
+  void UsePrepared(const RowData_t &rows) {
+    StartNewImage(ScreenAspect::kAlongWidth);
+    rows_ = rows;
+    row_end_ = rows.rows;
+    finalized_ = true;
+  }
+
+  // Set pixel on (x,y); interpreted in the context of Screenaspect
+  void SetPixel(int x, int y, bool on = true) {
+    if (aspect_type_ == ScreenAspect::kAlongLength) {
+      std::swap(x, y);
+      x = kColumns - x;
+    }
+    if (x < 0 || x >= kColumns) {
+      return;
+    }
+
+    uint64_t &to_modify = RowWord(at(y), x / 64);
+    const uint64_t bit = (uint64_t{1} << 63) >> (x % 64);
+    if (on) {
+      to_modify |= bit;
+    } else {
+      to_modify &= ~bit;
+    }
+  }
+
+  // Set up to 64 pixels that lie along one row with a single row access;
+  // for kAlongWidth pixels (x + i, y) for bit 63 - i, for kAlongLength
+  // pixels (x, y + i) for bit i. Pixels are only set, never cleared. As
+  // with SetPixel(), the image grows to include the row if any of the 64
+  // pixel positions is on the tape, even if no bits are set.
+  void BlitAlongRow(int x, int y, uint64_t bits) {
+    int row = 0;
+    RowBits_t placed{};
+    if (AlongRow(aspect_type_, x, y, bits, &row, &placed)) at(row) |= placed;
+  }
+
+  ScreenAspect aspect() const { return aspect_type_; }
+
+  // Provides access to the given row, possibly expanding the current image.
+  // Rows that already left the canvas can't be changed anymore.
+  RowBits_t &at(int r) {
+    if (r < canvas_start_ || finalized_ || use_list_) {  // error fallback
+      discarded_ = RowBits_t{};
+      return discarded_;
+    }
+    while (r >= canvas_start_ + kCanvasRows) FlushRow();
+    row_end_ = (r >= row_end_) ? (r + 1) : row_end_;  // implicit last
+    return canvas_[r % kCanvasRows];
+  }
+
+  void push_back(RowBits_t row_bits) { at(row_end_) = row_bits; }
+
+  size_t size() const { return row_end_; }
+
+  // Convert the rest of the image to physical rows ready to be sent, with
+  // the even/odd line offset at the end. After this, the image can't be
+  // modified until the next StartNewImage().
+  void Finalize() {
+    if (finalized_) return;
+    if (use_list_) {  // Rows are drawn while printing.
+      row_end_ = list_.rows() + kEvenOddLineOffset;
+      finalized_ = true;
+      return;
+    }
+    // We want to start the line offset earlier to cover all the bits.
+    row_end_ += kEvenOddLineOffset;
+    while (canvas_start_ < row_end_) FlushRow();
+    rows_ = encoder_.data();
+    row_end_ = rows_.rows;  // Less if the store ran out of space.
+    finalized_ = true;
+  }
+
+  // Store ran out of space; rows at the end of the image are missing.
+  bool full() const { return full_; }
+
+  // Rows as they go on the wire. Only valid after Finalize(), and not for a
+  // display list; see ListReader.
+  const RowData_t &physical_rows() const { return rows_; }
+
+  // Reads the rows of a display list as they go on the wire, drawing each
+  // when it is needed; same interface as RowReader. A row goes out again
+  // four rows later for the even/odd line offset: a window keeps the rows
+  // drawn last, so that reading in order, either way, draws each row once.
+  class ListReader {
+   public:
+    ListReader() = default;
+    explicit ListReader(const DisplayList_t *list)
+        : list_(list), rows_(list->rows()) {}
+
+    void Seek(int row) {
+      if (row == index_) return;
+      wire_ = WireRow(Drawn(row), Drawn(row - kEvenOddLineOffset));
+      index_ = row;
+    }
+
+    int index() const { return index_; }
+    const RowBits_t *row() const { return &wire_; }
+
+   private:
+    static constexpr int kWindow = 2 * kEvenOddLineOffset;  // Power of two.
+
+    RowBits_t Drawn(int r) {
+      Window &drawn = window_[r & (kWindow - 1)];
+      if (drawn.row != r) {
+        drawn.bits = (r >= 0 && r < rows_) ? list_->Row(r) : RowBits_t{};
+        drawn.row = r;
+      }
+      return drawn.bits;
+    }
+
+    struct Window {
+      int row = INT_MIN;
+      RowBits_t bits{};
+    };
+
+    const DisplayList_t *list_ = nullptr;
+    int rows_ = 0;
+    int index_ = INT_MIN;
+    RowBits_t wire_{};
+    Window window_[kWindow];
+  };
+
+  // Takes rows of a stream as they go on the wire, in the order they were
+  // pushed; same interface as RowReader, for reading from the last row
+  // down. Each step takes the next row, blank on an underrun, and pairs it
+  // with the one taken four steps before for the even/odd line offset.
+  // Seeking back stays on the current row: the stream can't rewind. Once
+  // the stream ended and the last row taken went out four steps later, the
+  // rows are past_end().
+  class StreamReader {
+   public:
+    StreamReader() = default;
+    explicit StreamReader(RowStream_t *stream) : stream_(stream) {}
+
+    void Seek(int row) {
+      for (/**/; index_ > row; --index_) Step();
+    }
+
+    int index() const { return index_; }
+    const RowBits_t *row() const { return &wire_; }
+
+    // Done: nothing of the stream left for this row or the ones after.
+    bool past_end() const { return past_end_; }
+
+   private:
+    void Step() {
+      const bool live = stream_->live();  // Before Pop(): rows pushed first.
+      RowBits_t next{};
+      if (stream_->Pop(&next)) {
+        since_last_ = 0;
+      } else if (since_last_ <= kEvenOddLineOffset) {
+        ++since_last_;
+      }
+      past_end_ = !live && since_last_ > kEvenOddLineOffset;
+      RowBits_t &before = delay_[steps_++ % kEvenOddLineOffset];
+      wire_ = WireRow(before, next);  // Odd pixels go out first.
+      before = next;
+    }
+
+    RowStream_t *stream_ = nullptr;
+    int index_ = INT_MAX;
+    uint32_t steps_ = 0;
+    int since_last_ = kEvenOddLineOffset + 1;  // Steps without a row.
+    bool past_end_ = false;
+    RowBits_t wire_{};
+    RowBits_t delay_[kEvenOddLineOffset] = {};  // Rows of the last steps.
+  };
+
+  // Bytes needed to Prepare() the given bitmap.
+  template <size_t N>
+  static constexpr size_t PreparedSize(const RowBits_t (&bitmap)[N]) {
+    return Prepare<0>(bitmap).size();
+  }
+
+  // Finalize a bitmap at compile time, e.g.
+  //  static constexpr auto kRows =
+  //      FrameBuffer::Prepare<FrameBuffer::PreparedSize(kBitmap)>(kBitmap);
+  //  frame.UsePrepared(kRows.data());
+  template <size_t kBytes, size_t N>
+  static constexpr RowEncoder<kBytes, RowBits_t> Prepare(
+      const RowBits_t (&bitmap)[N]) {
+    return Prepare<kBytes>(bitmap, N);
+  }
+
+  // Same for the first rows of a bitmap; also works at runtime.
+  template <size_t kBytes>
+  static constexpr RowEncoder<kBytes, RowBits_t> Prepare(
+      const RowBits_t *bitmap, size_t rows) {
+    RowEncoder<kBytes, RowBits_t> result;
+    for (size_t row = 0; row < rows + kEvenOddLineOffset; ++row) {
+      const RowBits_t bits = row < rows ? bitmap[row] : RowBits_t{};
+      const RowBits_t before = row >= 4 ? bitmap[row - 4] : RowBits_t{};
+      result.Append(WireRow(bits, before));
+    }
+    return result;
+  }
+
+  // Row as it goes on the wire: even/odd interleave, mapping to shift
+  // register bits and byte order. The boards are chained, so the one for
+  // the rightmost pixels comes first. Public, as the steps below, for
+  // render-bench to time.
+  //
+  // With several lanes, lane l is the chain of panels l * kPanels / kLanes
+  // on, and each step of the clock takes one bit of every lane: kLanes bits
+  // in a row, lane 0 in the last of them. So the bytes can be fed to the
+  // output as they are.
+  static constexpr RowBits_t WireRow(const RowBits_t &bits,
+                                     const RowBits_t &four_before) {
+    uint64_t panel[kPanels] = {};  // First bit to shift out in bit 63.
+    for (int w = 0; w < kPanels; ++w) {
+      // Even/Odd Pixels are interleaved 4 rows apart.
+      const uint64_t interleaved =
+          (RowWord(bits, w) & 0x5555'5555'5555'5555) |
+          (RowWord(four_before, w) & 0xAAAA'AAAA'AAAA'AAAA);
+      panel[w] = MapToPhysical(interleaved);
+    }
+    RowBits_t result{};
+    if constexpr (kLanes == 1) {
+      for (int w = 0; w < kPanels; ++w) {
+        RowWord(result, kPanels - 1 - w) = __builtin_bswap64(panel[w]);  // LE
+      }
+    } else {
+      // Word w of the stream has the bits of chunk w % kLanes of the chain
+      // word w / kLanes of each lane.
+      constexpr int kChainWords = kPanels / kLanes;
+      constexpr int kChunkBits = 64 / kLanes;
+      for (int w = 0; w < kPanels; ++w) {
+        const int shift = 64 - (w % kLanes + 1) * kChunkBits;
+        uint64_t stream = 0;
+        for (int lane = 0; lane < kLanes; ++lane) {
+          const uint64_t chain_word =
+              panel[(lane + 1) * kChainWords - 1 - w / kLanes];
+          const uint64_t chunk =
+              (chain_word >> shift) & ((uint64_t{1} << kChunkBits) - 1);
+          stream |= SpreadBits(chunk) << lane;
+        }
+        RowWord(result, w) = __builtin_bswap64(stream);  // LE
+      }
+    }
+    return result;
+  }
+
+  // Map data of one shift register chip to be from interleaved to the
+  // corresponding bits on the top and bottom.
+  static constexpr uint16_t MapChipBits(uint16_t data) {
+    // -- Led mapping of bits in shift-register vs. position.
+    constexpr uint8_t newpos[] = {7, 8,  6, 9,  5, 10, 4, 11,
+                                  3, 12, 2, 13, 1, 14, 0, 15};
+    // There is probably a delightful hackers bit-fiddling that can do this,
+    // but here pedestrian; only used to build the ChipByteMap at compile time.
+    uint16_t result = 0;
+    for (uint8_t i = 0; i < 16; ++i) {
+      if (data & (1 << i)) result |= (1 << newpos[i]);
+    }
+    return result;
+  }
+
+  // Physical mapping of the 64 bits of one panel, mapped to the particular
+  // layout of the bits in its four 16-bit shift register to LEDs they end
+  // up at. Table-driven: each chip is mapped by looking up its low and high
+  // byte.
+  static constexpr uint64_t MapToPhysical(uint64_t data) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 16) {
+      const uint16_t chip_bits =
+          kChipByteMap.low[(data >> shift) & 0xff] |
+          kChipByteMap.high[(data >> (shift + 8)) & 0xff];
+      result |= static_cast<uint64_t>(chip_bits) << shift;
+    }
+    return result;
+  }
+
+ private:
+  // Bit i of the low 64 / kLanes bits of x to bit i * kLanes.
+  static constexpr uint64_t SpreadBits(uint64_t x) {
+    for (int s = 32 / kLanes; s >= 1; s /= 2) {
+      uint64_t mask = 0;  // Blocks of s bits, s * kLanes apart.
+      for (int b = 0; b < 64; b += s * kLanes) {
+        mask |= ((uint64_t{1} << s) - 1) << b;
+      }
+      x = (x | x << (s * (kLanes - 1))) & mask;
+    }
+    return x;
+  }
+
+  // Move the first row of the canvas to the store.
+  void FlushRow() {
+    RowBits_t &bits = canvas_[canvas_start_ % kCanvasRows];
+    RowBits_t &before = flushed_[canvas_start_ % kEvenOddLineOffset];
+    if (!encoder_.Append(WireRow(bits, before))) full_ = true;  // Dropped.
+    before = bits;
+    bits = RowBits_t{};
+    ++canvas_start_;
+  }
+
+  // MapChipBits() for each value of the low and high byte of a chip.
+  struct ChipByteMap {
+    uint16_t low[256];
+    uint16_t high[256];
+  };
+  static constexpr ChipByteMap MakeChipByteMap() {
+    ChipByteMap result{};
+    for (int b = 0; b < 256; ++b) {
+      result.low[b] = MapChipBits(b);
+      result.high[b] = MapChipBits(b << 8);
+    }
+    return result;
+  }
+
+  static const ChipByteMap kChipByteMap;
+
+  RowBits_t canvas_[kCanvasRows] = {};  // Ring buffer of rows being drawn.
+  int canvas_start_ = 0;  // First row still on canvas; rows before: flushed.
+  RowBits_t flushed_[kEvenOddLineOffset] = {};  // For the line offset.
+  RowBits_t discarded_{};
+  int row_end_ = 0;  // like an end() iterator: the row beyond last.
+  RowEncoder<kMaxBytes, RowBits_t> encoder_;
+  RowData_t rows_;
+  ScreenAspect aspect_type_ = ScreenAspect::kAlongWidth;
+  bool finalized_ = false;  // rows_ contains the physical rows.
+  bool full_ = false;
+  DisplayList_t list_;
+  uint32_t list_key_ = 0;  // Content of list_, if named.
+  bool use_list_ = false;  // Image is list_, not drawn.
+  uint32_t drawn_key_ = 0;  // Rows are list_ with that key, drawn.
+};
+
+template <int kPanels, int kLanes>
+inline constexpr typename BasicFrameBuffer<kPanels, kLanes>::ChipByteMap
+    BasicFrameBuffer<kPanels, kLanes>::kChipByteMap =
+        BasicFrameBuffer<kPanels, kLanes>::MakeChipByteMap();
+
+// Frame for the panels and output lanes the firmware is built for.
+using FrameBuffer = BasicFrameBuffer<kPanelCount, kOutputLanes>;
+
+// Image drawn at compile time, e.g. with WriteText() from glyph-font.h, to
+// be turned into rows with FrameBuffer::Prepare(). Pixels beyond kRows are
+// dropped.
+template <size_t kRows, int kPanels = kPanelCount>
+struct RowImage {
+  using Frame = BasicFrameBuffer<kPanels>;
+
+  constexpr explicit RowImage(ScreenAspect type) : aspect_type(type) {}
+
+  constexpr ScreenAspect aspect() const { return aspect_type; }
+
+  constexpr void BlitAlongRow(int x, int y, uint64_t bits) {
+    int row = 0;
+    typename Frame::RowBits_t placed{};
+    if (AlongRow(aspect_type, x, y, bits, &row, &placed) && row >= 0 &&
+        row < static_cast<int>(kRows)) {
+      rows[row] |= placed;
+    }
+  }
+
+  ScreenAspect aspect_type;
+  typename Frame::RowBits_t rows[kRows] = {};
+};
+#endif
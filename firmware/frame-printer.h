@@ -1,169 +1,486 @@
 #ifndef FRAME_PRINTER_H
 #define FRAME_PRINTER_H
 
-#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstdint>
 
+#include "frame-buffer.h"
+#include "gray-frame.h"
 #include "hardware/gpio.h"
-#include "hardware/spi.h"
+#include "hardware/sync.h"
 #include "pico/time.h"
+#include "row-output.h"
+#include "row-store.h"
 
-enum class ScreenAspect {
-  kAlongWidth,   // X axis along width; (0, 0) at top left after full pull.
-  kAlongLength,  // X axis along length; (0, 0) first in pull, at top.
-};
-
+// Sends rows of a FrameBuffer to the Glowxels shift registers and flashes
+// them.
+//
 // Sequence
-//  StartNewImage();
-//  SetPixel()...
-//  for (SendStart(); SendNext(); /**/) {
+//  for (SendStart(&frame); SendNext(); /**/) {
 //    WaitForSync();
-//    LighFlash(flashmillis);
+//    LighFlash(flash_usec);
 //  }
 //
+// Rows are shifted out ahead of time: the row for the next sync is sent and
+// latched right after the previous flash, so that by the time SendNext() is
+// called it typically is already waiting in the shift registers.
+//
+// LightFlash() returns right away; a timer alarm ends the flash. If the next
+// sync arrives while the flash is still on, SendNext() truncates it: the
+// tape moved on, so the lit row would only smear into the next one.
+//
+// Grayscale frames are flashed as a sequence of exposures per row, one per
+// bit-plane, timed by alarms: each plane is latched while the LEDs are off
+// in between (see PlanExposures()).
+//
+// The next frame can be committed while one is printing, e.g. by the other
+// core: SendNext() swaps it in at a row boundary, so the printed frame is
+// never written to and the new one starts with its last row.
+//
+// Frames described by a display list are drawn a row at a time while
+// printing. Drawing is not for the alarm interrupt: DrawAhead(), called
+// after LightFlash(), draws the next row while the LEDs are on, and the end
+// of the flash only sends it if it is ready. Otherwise it is drawn and sent
+// by the next SendNext().
+//
+// A row stream is printed as its rows arrive, one row per SendNext(), for as
+// long as it is live; an underrun prints a blank row. Printing continues
+// where it stopped with the next pull, until the stream ended.
+//
+// Instead of making the row ready once the sync was noticed, it can be made
+// ready ahead with SendNextArmed(); FlashNow(), e.g. from the interrupt of
+// the sync, then starts the flash right away. SendHalfRowAt() flashes a row
+// in between the one just flashed and the next at a set time, with the
+// pixels lit in both.
 class FramePrinter {
-  static constexpr int kMaxRows = 1024;
   static constexpr uint8_t kLightFlashPin = 8;
-  static constexpr uint8_t kEvenOddLineOffset = 4;
 
- public:
-  using RowBits_t = uint64_t;
-  FramePrinter(int spiTxPin, spi_inst_t *instance) : instance_(instance) {
-    spi_init(instance_, 1'000'000);
-    spi_set_format(instance_, 8,            // Regylar 8 bits transfer
-                   spi_cpol_t::SPI_CPOL_1,  // pos polarity
-                   spi_cpha_t::SPI_CPHA_1,  // phase
-                   spi_order_t::SPI_MSB_FIRST);
-    // Luckily, the RP2040 has pin-muxing pretty standardized and we can derive
-    // the remaining pins from just knowing one pin.
-    const int spiSckPin = spiTxPin - 1;
-    const int spiCsPin = spiTxPin - 2;  // Also called 'latch' on glowxels
-    gpio_set_function(spiTxPin, GPIO_FUNC_SPI);
-    gpio_set_function(spiSckPin, GPIO_FUNC_SPI);
-    gpio_set_function(spiCsPin, GPIO_FUNC_SPI);
+  // Time to shift out and latch a row between the exposures of two planes.
+  static constexpr uint32_t kPlaneShiftUsec =
+      RowOutput::ShiftUsec(sizeof(FrameBuffer::RowBits_t)) + 16;
+
+  // Shorter exposures are not worth the time to shift out their plane.
+  static constexpr uint32_t kMinPlaneUsec = 200;
 
+ public:
+  using RowBits_t = FrameBuffer::RowBits_t;
+  // Rows go out on the given data pin (and the ones above for more lanes),
+  // latch and clock on the two pins below; see row-output.h.
+  template <typename Instance>
+  FramePrinter(int data_pin, Instance instance) : output_(data_pin, instance) {
     gpio_init(kLightFlashPin);
     gpio_set_dir(kLightFlashPin, GPIO_OUT);
     gpio_put(kLightFlashPin, true);  // ~OE
   }
 
-  // Start sending the new
-  void SendStart() {
-    send_pos_ = row_end_ - 1;
-    if (send_pos_ >= kMaxRows - kEvenOddLineOffset) return;
-    // We want to start the line offset earlier to cover all the bits.
-    for (uint8_t i = 0; i < kEvenOddLineOffset; ++i) {
-      row_[++send_pos_] = 0;
+  // Start sending the given frame, finalizing it if needed. The frame must
+  // stay unchanged until done sending or the next SendStart(). Drops a frame
+  // committed before.
+  void SendStart(FrameBuffer *frame) {
+    committed_.store(nullptr, std::memory_order_relaxed);
+    Start(frame, true);
+  }
+
+  // Hand over the finalized frame to continue with; safe to call from the
+  // other core or an interrupt. SendNext() swaps it in once the row before
+  // at_row is due: 0 right after the current frame, negative to leave that
+  // many blank rows first. Replaces a frame committed before that is not
+  // swapped in yet. The frame must stay unchanged until the printer moved
+  // on from it, see frame().
+  void Commit(FrameBuffer *frame, int at_row = 0) {
+    commit_row_.store(at_row, std::memory_order_relaxed);
+    committed_.store(frame, std::memory_order_release);
+  }
+
+  // Frame being sent: the one of the last SendStart() or swapped in since;
+  // nullptr for a grayscale frame.
+  const FrameBuffer *frame() const { return frame_; }
+
+  // Start sending a grayscale frame. Its rows must stay around until done.
+  void SendStart(const GrayFrame &frame) {
+    committed_.store(nullptr, std::memory_order_relaxed);
+    StopFlash();
+    WaitRowLatched();
+    for (int p = 0; p < kGrayPlanes; ++p) {
+      rows_[p] = RowReader(frame.planes[p]);
     }
+    frame_ = nullptr;
+    source_ = kStoredRows;
+    planes_ = kGrayPlanes;
+    size_ = frame.planes[0].rows;
+    send_pos_ = size_ - 1;
+    last_row_ = size_;
+    QueueRow(send_pos_);
   }
 
-  // Send next line. Can be done independently of actually flashing the light.
+  // Start sending rows of a stream as they come. Keeps going past pulls
+  // until the stream ended; see streaming().
+  void SendStart(FrameBuffer::RowStream_t *stream) {
+    committed_.store(nullptr, std::memory_order_relaxed);
+    StopFlash();
+    WaitRowLatched();
+    stream_rows_ = FrameBuffer::StreamReader(stream);
+    frame_ = nullptr;
+    source_ = kRowStream;
+    planes_ = 1;
+    size_ = INT_MAX;  // Counting down from the top, as for frames.
+    send_pos_ = size_ - 1;
+    last_row_ = size_;
+    QueueRow(send_pos_);
+  }
+
+  // Sending a stream that has not ended yet, or not all of its rows went
+  // out.
+  bool streaming() const {
+    return source_ == kRowStream && !stream_rows_.past_end();
+  }
+
+  // Make the next line ready to be flashed: it has been shifted out ahead
+  // of time, so typically this does not have to wait for anything. Can be
+  // done independently of actually flashing the light. Continues with a
+  // committed frame once it is due.
   // Returns 'true' if there is more to send.
   bool SendNext() {
-    if (send_pos_ < 0) {
-      SendData(0);  // Make sure no stray LEDs go on when OE is pulled down.
+    if (FrameBuffer *next = TakeCommitted()) Start(next, true);
+    const bool lit = LatchRow(send_pos_);
+    // Swap in a frame that is due with the next row. If this row is flashed,
+    // the end of the flash shifts out the first row of the new frame; the
+    // planes of a grayscale row need their frame until then.
+    FrameBuffer *next = (lit && planes_ > 1) ? nullptr : TakeCommitted();
+    if (next) {
+      Start(next, !lit);
+    } else if (!lit) {  // No flash to wait for: shift out the next row now.
+      QueueRow(send_pos_);
+    }
+    return lit;
+  }
+
+  // As SendNext(), with the flash left for FlashNow() to start once the tape
+  // reaches the row. Nothing flashes it otherwise: a row flashed before its
+  // sync would be out of place.
+  bool SendNextArmed(uint32_t microseconds) {
+    const bool lit = SendNext();
+    if (!lit) return false;
+    StopFlash();
+    exposures_ = PlanExposures(microseconds, planes_, exposure_usec_);
+    plane_ = 0;
+    const uint32_t irq_state = save_and_disable_interrupts();
+    armed_ = true;
+    armed_half_ = false;
+    flash_alarm_ = 0;  // No alarm; see FlashNow().
+    restore_interrupts(irq_state);
+    return true;
+  }
+
+  // Flash the row in between the one flashed last and the next one at the
+  // given time, after the flash before is over: the pixels lit in both rows.
+  // As pixels of the wire rows are those of the same columns, this works on
+  // them directly. Single bit-plane only. Returns false if there is no such
+  // row or not enough time to shift it out.
+  bool SendHalfRowAt(absolute_time_t at, uint32_t microseconds) {
+    if (planes_ > 1 || !lit_ ||
+        absolute_time_diff_us(get_absolute_time(), at) < kPlaneShiftUsec) {
       return false;
     }
-    SendData(assembleLedDataAt(send_pos_));
-    --send_pos_;
+    StopFlash();
+    if (!row_queued_ || queued_row_ != send_pos_) QueueRow(send_pos_);
+    if (!InImage(send_pos_)) return false;
+    WaitRowLatched();  // Done with the next row; sent again after the flash.
+    half_row_ = lit_row_ & queued_bits_;
+    output_.Send(&half_row_, sizeof(RowBits_t));
+    blank_sent_ = false;
+    row_queued_ = false;
+    LightFlashAt(at, microseconds);
     return true;
   }
 
-  void LightFlash(uint16_t milliseconds) {
-    gpio_put(kLightFlashPin, false);  // ~OE
-    sleep_ms(milliseconds);
-    gpio_put(kLightFlashPin, true);
+  // Make the given row ready to be flashed, for rows addressed by tape
+  // position. The row after it in the direction of the last step is shifted
+  // out ahead of time; if the tape changed direction, the row is sent now.
+  // Returns 'true' if the row is part of the image; otherwise a blank row is
+  // latched.
+  bool SendRow(int row) {
+    const bool lit = LatchRow(row);
+    if (!lit) QueueRow(send_pos_);
+    return lit;
+  }
+
+  // Draw the row to send next of a display list frame, so that it can go
+  // out as soon as the flash ends; to be called after LightFlash(). Nothing
+  // to do for other frames.
+  void DrawAhead() {
+    if (source_ != kDisplayList || send_pos_ < 0 || send_pos_ >= size_) return;
+    if (drawn_row_.load(std::memory_order_relaxed) == send_pos_) return;
+    list_rows_.Seek(send_pos_);
+    drawn_row_.store(send_pos_, std::memory_order_release);
   }
 
-  void StartNewImage(ScreenAspect type) {
-    // Clear out previous image.
-    for (int i = 0; i < row_end_; ++i) {
-      row_[i] = 0;
+  // Number of rows of the frame being sent.
+  int rows() const { return size_; }
+
+  // Switch on LEDs of the row made ready by SendNext() for the given time.
+  // Does not block, the flash is ended by an alarm. For a grayscale frame,
+  // this is the time for a full-on pixel, split among the bit-planes.
+  void LightFlash(uint32_t microseconds) {
+    StopFlash();
+    exposures_ = PlanExposures(microseconds, planes_, exposure_usec_);
+    plane_ = 0;
+    StartExposure();
+  }
+
+  // Start the flash set up with SendNextArmed(), if any. Also from an
+  // interrupt. A half row not started yet is dropped: the tape is at the
+  // next row already.
+  void FlashNow() {
+    const uint32_t irq_state = save_and_disable_interrupts();
+    if (armed_ && !armed_half_) {
+      armed_ = false;
+      WaitRowLatched();
+      StartExposure();
+    } else if (armed_) {
+      if (flash_alarm_) cancel_alarm(flash_alarm_);
+      armed_ = false;
+      plane_ = exposures_;
     }
-    aspect_type_ = type;
-    row_end_ = 0;
+    restore_interrupts(irq_state);
   }
 
-  // Set pixel on (x,y); interpreted in the context of Screenaspect
-  void SetPixel(int x, int y, bool on = true) {
-    constexpr int kMaxColumns = sizeof(RowBits_t) * 8;
-    if (aspect_type_ == ScreenAspect::kAlongLength) {
-      std::swap(x, y);
-      x = 64 - x;
+  // The system clock changed: shift rows out at the same rate as before.
+  void ClockChanged() { output_.ClockChanged(); }
+
+  // Called from the interrupt each time a flash is over, e.g. to wake up the
+  // task making the next row ready.
+  void set_flash_notify(void (*notify)()) { flash_notify_ = notify; }
+
+  // Splits the time of a full-on pixel into exposures of the first planes,
+  // most significant first, each half as long as the one before. Latching
+  // the following planes comes out of the same time, so the whole sequence
+  // takes full_usec. Low-order planes are dropped while the shortest
+  // exposure would be below kMinPlaneUsec: if the tape is pulled fast, there
+  // are fewer levels rather than smeared rows. Returns planes to expose.
+  static constexpr int PlanExposures(uint32_t full_usec, int planes,
+                                     uint32_t *usec) {
+    int count = planes;
+    uint32_t unit = full_usec;
+    for (/**/; count > 1; --count) {
+      const uint32_t shifting = (count - 1) * kPlaneShiftUsec;
+      if (full_usec <= shifting) continue;
+      unit = (full_usec - shifting) / ((1 << count) - 1);
+      if (unit >= kMinPlaneUsec) break;
     }
-    if (x < 0 || x >= kMaxColumns) {
-      return;
+    if (count == 1) unit = full_usec;
+    for (int p = 0; p < count; ++p) usec[p] = unit << (count - 1 - p);
+    return count;
+  }
+
+  // Planes exposed in the most recent flash.
+  int exposures() const { return exposures_; }
+
+  // Timing of the most recent flash, e.g. for timing measurements.
+  absolute_time_t flash_start_time() const { return flash_start_time_; }
+  absolute_time_t flash_end_time() const { return flash_end_time_; }
+  bool flash_active() const { return flash_active_; }
+  bool flash_armed() const { return armed_; }  // Not started yet.
+  uint32_t truncated_flashes() const { return truncated_flashes_; }
+
+ private:
+  // Have row in the shift registers; returns if it is part of the image.
+  bool LatchRow(int row) {
+    StopFlash();
+    if (!row_queued_ || queued_row_ != row) QueueRow(row);
+    WaitRowLatched();
+    row_queued_ = false;
+    send_pos_ = (row > last_row_) ? row + 1 : row - 1;  // Expected next.
+    last_row_ = row;
+    lit_ = InImage(row);
+    lit_row_ = queued_bits_;
+    return lit_;
+  }
+
+  // Row, just queued, is part of the image.
+  bool InImage(int row) const {
+    if (source_ == kRowStream) return !stream_rows_.past_end();
+    return row >= 0 && row < size_;
+  }
+
+  // The committed frame, if it is due for the row to be sent next.
+  FrameBuffer *TakeCommitted() {
+    FrameBuffer *next = committed_.load(std::memory_order_acquire);
+    if (!next || send_pos_ >= commit_row_.load(std::memory_order_relaxed)) {
+      return nullptr;
     }
+    return committed_.compare_exchange_strong(next, nullptr) ? next : nullptr;
+  }
 
-    RowBits_t &to_modify = at(y);
-    constexpr RowBits_t kLeftMostBit = static_cast<RowBits_t>(1) << 63;
-    if (on) {
-      to_modify |= kLeftMostBit >> x;
+  // Make frame the one to send, its first row shifted out now or with queue
+  // false, by the end of the flash of the row latched.
+  void Start(FrameBuffer *frame, bool queue) {
+    StopFlash();
+    WaitRowLatched();  // The row queued after the last flash reads rows_.
+    frame->Finalize();
+    source_ = frame->display_list() ? kDisplayList : kStoredRows;
+    if (source_ == kDisplayList) {
+      list_rows_ = FrameBuffer::ListReader(frame->display_list());
+      drawn_row_.store(-1, std::memory_order_relaxed);
     } else {
-      to_modify &= ~(kLeftMostBit >> x);
+      rows_[0] = RowReader(frame->physical_rows());
     }
+    frame_ = frame;
+    planes_ = 1;
+    size_ = frame->size();
+    send_pos_ = size_ - 1;
+    last_row_ = size_;
+    if (queue) QueueRow(send_pos_);  // First row ready before the first sync.
   }
 
-  // Provides access to the given row, possibly expanding the current image.
-  RowBits_t &at(int r) {
-    if (r < 0 || r >= kMaxRows) return row_[kMaxRows - 1];  // error fallback
-    row_end_ = (r >= row_end_) ? (r + 1) : row_end_;        // implicit last
-    return row_[r];
+  // Start shifting out given finalized row (blank if outside the image) of
+  // the given plane; it is latched once the last bit is out. Rows are
+  // decoded one step at a time, so this is cheap enough for the alarm
+  // interrupt. Rows of a display list are drawn, unless drawn ahead; rows
+  // of a stream are taken from it.
+  void QueueRow(int row, int plane = 0) {
+    static constexpr RowBits_t kBlankRow{};
+    WaitRowLatched();  // Only one transfer in flight; it reads rows_.
+    const bool blank = row < 0 || row >= size_;
+    const RowBits_t *bits = &kBlankRow;
+    if (blank) {
+      // Nothing to read.
+    } else if (source_ == kDisplayList) {
+      list_rows_.Seek(row);
+      drawn_row_.store(row, std::memory_order_relaxed);
+      bits = list_rows_.row();
+    } else if (source_ == kRowStream) {
+      stream_rows_.Seek(row);
+      bits = stream_rows_.row();
+    } else {
+      rows_[plane].Seek(row);
+      bits = rows_[plane].row();
+    }
+    if (!blank || !blank_sent_) {  // Blank again needs no shifting.
+      output_.Send(bits, sizeof(RowBits_t));
+    }
+    if (plane == 0) queued_bits_ = *bits;
+    blank_sent_ = blank;
+    queued_row_ = row;
+    row_queued_ = true;
   }
 
-  void push_back(RowBits_t row_bits) {
-    if (row_end_ >= kMaxRows) return;
-    row_[row_end_++] = row_bits;
+  static int64_t FlashAlarmCallback(alarm_id_t, void *user_data) {
+    static_cast<FramePrinter *>(user_data)->EndExposure();
+    return 0;  // No re-schedule
   }
 
-  size_t size() const { return row_end_; }
+  static int64_t StartAlarmCallback(alarm_id_t, void *user_data) {
+    FramePrinter *printer = static_cast<FramePrinter *>(user_data);
+    printer->armed_ = false;
+    printer->WaitRowLatched();
+    printer->StartExposure();
+    return 0;
+  }
 
-  void SendData(RowBits_t value) {
-    // rp2040 stores things in LE, but we
-    RowBits_t big_endian = __builtin_bswap64(value);  // rp2040 is LE
-    spi_write_blocking(instance_, (uint8_t *)&big_endian, sizeof(big_endian));
+  static int64_t PlaneAlarmCallback(alarm_id_t, void *user_data) {
+    FramePrinter *printer = static_cast<FramePrinter *>(user_data);
+    printer->WaitRowLatched();  // Typically done by now.
+    printer->StartExposure();
+    return 0;
   }
 
- private:
-  // Get column-offset and shift layoyt ready bits.
-  RowBits_t assembleLedDataAt(int row) { return MapToPhysical(BitsAtRow(row)); }
-
-  RowBits_t BitsAtRow(int row) {
-    // Even/Odd Pixels are interleaved 4 rows apart.
-    RowBits_t result = row_[row] & 0x5555'5555'5555'5555;
-    if (row >= 4) result |= row_[row - 4] & 0xAAAA'AAAA'AAAA'AAAA;
-    return result;
-  }
-
-  // Physical mapping of 64 bits, mapped to the particular layout of the
-  // bits in the four 16-bit shift register to LEDs they end up at.
-  RowBits_t MapToPhysical(RowBits_t data) {
-    return (static_cast<RowBits_t>(MapChipBits(data >> 48)) << 48) |
-           (static_cast<RowBits_t>(MapChipBits(data >> 32)) << 32) |
-           (static_cast<RowBits_t>(MapChipBits(data >> 16)) << 16) |
-           (static_cast<RowBits_t>(MapChipBits(data >> 0)) << 0);
-  }
-
-  // Map data of one shift register chip to be from interleaved to the
-  // corresponding bits on the top and bottom.
-  constexpr uint16_t MapChipBits(uint16_t data) const {
-    // -- Led mapping of bits in shift-register vs. position.
-    constexpr uint8_t newpos[] = {7, 8,  6, 9,  5, 10, 4, 11,
-                                  3, 12, 2, 13, 1, 14, 0, 15};
-    // There is probably a delightful hackers bit-fiddling that can do this,
-    // but here pedestrian.
-    uint16_t result = 0;
-    for (uint8_t i = 0; i < 16; ++i) {
-      if (data & (1 << i)) result |= (1 << newpos[i]);
+  // As LightFlash(), started by an alarm at the given time. For half rows.
+  void LightFlashAt(absolute_time_t at, uint32_t microseconds) {
+    StopFlash();
+    exposures_ = PlanExposures(microseconds, planes_, exposure_usec_);
+    plane_ = 0;
+    const uint32_t irq_state = save_and_disable_interrupts();
+    armed_ = true;
+    armed_half_ = true;
+    const alarm_id_t alarm = add_alarm_at(at, &StartAlarmCallback, this, true);
+    if (armed_) flash_alarm_ = alarm;  // Otherwise started already.
+    restore_interrupts(irq_state);
+  }
+
+  // Called from alarm interrupt or LightFlash().
+  void StartExposure() {
+    flash_active_ = true;
+    gpio_put(kLightFlashPin, false);  // ~OE
+    if (plane_ == 0) flash_start_time_ = get_absolute_time();
+    flash_alarm_ = add_alarm_in_us(exposure_usec_[plane_], &FlashAlarmCallback,
+                                   this, true);
+  }
+
+  // Called from alarm interrupt or with interrupts disabled.
+  void EndExposure() {
+    gpio_put(kLightFlashPin, true);  // ~OE
+    flash_active_ = false;
+    if (++plane_ < exposures_) {  // Latch the next plane, then expose it.
+      QueueRow(last_row_, plane_);
+      flash_alarm_ =
+          add_alarm_in_us(kPlaneShiftUsec, &PlaneAlarmCallback, this, true);
+      return;
+    }
+    flash_end_time_ = get_absolute_time();
+
+    // LEDs are off now, so it is safe to latch the row for the next sync.
+    if (RowReady(send_pos_)) QueueRow(send_pos_);
+    if (flash_notify_) flash_notify_();
+  }
+
+  // Row can be sent without drawing it: not from a display list, blank or
+  // drawn ahead.
+  bool RowReady(int row) const {
+    return source_ != kDisplayList || row < 0 || row >= size_ ||
+           drawn_row_.load(std::memory_order_acquire) == row;
+  }
+
+  // End a still active flash or sequence of exposures early.
+  void StopFlash() {
+    const uint32_t irq_state = save_and_disable_interrupts();
+    if (plane_ < exposures_) {
+      if (flash_alarm_) cancel_alarm(flash_alarm_);
+      if (!armed_) ++truncated_flashes_;  // Was on, not just armed.
+      armed_ = false;
+      plane_ = exposures_ - 1;
+      EndExposure();
     }
-    return result;
+    restore_interrupts(irq_state);
   }
 
-  RowBits_t row_[kMaxRows] = {0};
-  int row_end_ = 0;  // like an end() iterator: the row beyond last.
-  ScreenAspect aspect_type_ = ScreenAspect::kAlongWidth;
+  void WaitRowLatched() { output_.WaitLatched(); }
+
+  enum Source { kStoredRows, kDisplayList, kRowStream };
+
+  RowReader rows_[kGrayPlanes];  // Current row of each plane being sent.
+  FrameBuffer::ListReader list_rows_;  // Instead, for a display list.
+  FrameBuffer::StreamReader stream_rows_;  // Or for a stream.
+  Source source_ = kStoredRows;
+  std::atomic<int> drawn_row_{-1};  // Row in list_rows_, if drawn.
+  FrameBuffer *frame_ = nullptr;
+  std::atomic<FrameBuffer *> committed_{nullptr};  // To swap in next.
+  std::atomic<int> commit_row_{0};
+  int planes_ = 1;
+  int size_ = 0;
+  int send_pos_ = -1;  // Row expected to be sent next.
+  int last_row_ = 0;   // Row sent last.
+  volatile int queued_row_ = -1;
+  RowBits_t queued_bits_{};  // Of queued_row_, first plane.
+  RowBits_t lit_row_{};      // Latched last by SendNext() or SendRow().
+  RowBits_t half_row_{};     // Sent by SendHalfRowAt().
+  bool lit_ = false;         // lit_row_ is part of the image.
+
+  RowOutput output_;
+  volatile bool row_queued_ = false;  // Row sent but not yet given out.
+  volatile bool blank_sent_ = false;  // Shift registers hold a blank row.
 
-  int send_pos_ = -1;
-  spi_inst_t *const instance_;
+  volatile bool flash_active_ = false;
+  volatile bool armed_ = false;  // Flash waiting for its start alarm.
+  volatile bool armed_half_ = false;  // That flash is of a half row.
+  void (*flash_notify_)() = nullptr;
+  uint32_t exposure_usec_[kGrayPlanes] = {};
+  int exposures_ = 0;  // Planes to expose in the current flash.
+  volatile int plane_ = 0;  // Exposing now; exposures_ once done.
+  alarm_id_t flash_alarm_ = 0;
+  absolute_time_t flash_start_time_{};
+  volatile absolute_time_t flash_end_time_{};
+  uint32_t truncated_flashes_ = 0;
 };
 #endif
@@ -1,15 +1,27 @@
 #include <pico/types.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
 
-#include "bdfont-support.h"
 #include "button-counter.h"
+#include "flash-store.h"
 #include "frame-printer.h"
+#include "glyph-font.h"
+#include "gray-frame.h"
 #include "hardware/rtc.h"
+#include "idle-power.h"
 #include "line-reader.h"
+#include "packet-reader.h"
+#include "pico/multicore.h"
+#include "pico/util/queue.h"
 #include "strip-encoder.h"
+#include "task-scheduler.h"
+#include "tick-predictor.h"
+#include "tick-trace.h"
 
-// Generated font data
+// Generated font data, see make-glyph-font.py
 #include "font-6x9.h"
 #include "font-large.h"
 #include "font-message.h"
@@ -18,113 +30,418 @@
 // Some demo bitmap content
 #include "bitmap-contents.h"
 
-// Time a single line is flashing the 405nm LEDs.
-constexpr uint16_t kFlashTimeMillis = 5;
+// Time a single line is flashing the 405nm LEDs. Longest is what the glow
+// tape needs to saturate. When the tape is pulled quickly, flashes are made
+// shorter so that rows don't smear into each other, down to a minimum below
+// which the glow gets too faint.
+constexpr uint32_t kMaxFlashTimeUsec = 5'000;
+constexpr uint32_t kMinFlashTimeUsec = 1'500;
+
+// Fraction of the distance between rows the tape may move during a flash.
+constexpr uint32_t kMaxBlurPercent = 40;
 
 // GPIO where the input button lives. The Feather board has the BOOTSEL button
 // connected to this GPIO.
 constexpr int kButtonPin = 4;
 
-constexpr int kSpiTxPin = 11;  // TX1, 10=sck1, 9=CS1
-
-// A simple wrapper to emit bdfont text to out FramePrinter.
-static void WriteText(FramePrinter *out, const struct FontData *font, int xpos,
-                      int ypos, const char *print_text,
-                      bool right_aligned = false, int extra_space = 0) {
-  if (right_aligned) {
-    for (const char *txt = print_text; *txt; ++txt) {
-      auto g = bdfont_find_glyph(font, *txt);
-      if (g) xpos -= g->width;
-      xpos -= extra_space;
-    }
-  }
-  for (const char *txt = print_text; *txt; ++txt) {
-    int dx = 0;
-    xpos += BDFONT_EMIT_GLYPH(
-        font, *txt, false, { dx = 0; },
-        {
-          for (int i = 0; i < 8; ++i) {
-            out->SetPixel(xpos + dx, stripe * 8 + ypos + i, b & (1 << i));
-          }
-          ++dx;
-        },
-        {});
-    xpos += extra_space;
+constexpr int kSpiTxPin = 11;  // TX1, 10=sck1, 9=CS1; PIO lanes from 11 up.
+
+// Render content on core1 ahead of time, so that it is ready when the pull
+// starts. If false, content is rendered on the first tick of the pull.
+constexpr bool kPrerenderOnCore1 = true;
+
+// Encoder with a second pick-up, a quarter line apart from the first. Rows
+// are then printed by tape position: pausing, jiggling or pulling back the
+// tape does not misplace the rows that follow. Build with
+// -DQUADRATURE_ENCODER=1 to enable.
+#ifndef QUADRATURE_ENCODER
+#define QUADRATURE_ENCODER 0
+#endif
+constexpr bool kQuadratureEncoder = QUADRATURE_ENCODER;
+
+// Rows between the first tick and the first row of the image. Same as the
+// single channel encoder waiting for the tick predictor to lock.
+constexpr int kLeadRows = TickPredictor::kLeadEdges;
+
+// With the "repeat on" serial command, the content is printed again and again
+// while the tape is pulled, rendered anew each time, this many blank rows
+// apart. Single channel encoder only.
+constexpr int kRepeatGapRows = 16;
+constexpr int64_t kPullIdleUsec = 500'000;  // Pull is over; as StripEncoder.
+
+// Tasks not woken up by an interrupt, such as the button, are polled this
+// often. Once the pull is over, the main loop sleeps until an interrupt or
+// the next of these polls, see idle-power.h
+constexpr uint32_t kTaskPollUsec = 10'000;
+
+// Ticks kept in the timing trace shown with the "trace" and "stats" serial
+// commands; 16 bytes each. Zero compiles out tracing.
+constexpr size_t kTraceTicks = 1024;
+
+// Flash time for the current tape speed, given as time between ticks.
+static uint32_t FlashTimeUsec(int32_t tick_interval_usec) {
+  if (tick_interval_usec <= 0) return kMaxFlashTimeUsec;  // Unknown speed.
+  const uint32_t max_for_blur = tick_interval_usec * kMaxBlurPercent / 100;
+  return std::clamp(max_for_blur, kMinFlashTimeUsec, kMaxFlashTimeUsec);
+}
+
+// Rows half as far apart still get flashes of the minimum time.
+static bool RoomForHalfRows(int32_t tick_interval_usec) {
+  return tick_interval_usec / 2 * kMaxBlurPercent / 100 >= kMinFlashTimeUsec;
+}
+
+static const char *WeekdayName(int dotw) {
+  switch (dotw) {
+    case 0: return "Sunday";
+    case 1: return "Monday";
+    case 2: return "Tuesday";
+    case 3: return "Wednesday";
+    case 4: return "Thursday";
+    case 5: return "Friday";
+    case 6: return "Saturday";
   }
+  return "-";
 }
 
-void DrawTime(FramePrinter *out) {
+// Clock content, drawn from scratch.
+void DrawTime(FrameBuffer *out) {
   datetime_t now{};
   const bool time_valid = rtc_get_datetime(&now);
   if (!time_valid) {
     // RTC of rp2040 is a bit annoying, its content does not survive
     // resets. To be set with the set-time.sh script.
-    WriteText(out, &font_6x9, 2, 0, "Set Time!");
+    WriteText(out, font_6x9, 2, 0, "Set Time!");
     return;
   }
-  const char *weekday = "-";
-  switch (now.dotw) {
-    case 0: weekday = "Sunday"; break;
-    case 1: weekday = "Monday"; break;
-    case 2: weekday = "Tuesday"; break;
-    case 3: weekday = "Wednesday"; break;
-    case 4: weekday = "Thursday"; break;
-    case 5: weekday = "Friday"; break;
-    case 6: weekday = "Saturday"; break;
+  WriteText(out, font_6x9, FrameBuffer::kColumns - 2, 0,
+            WeekdayName(now.dotw), true);
+
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%4d-%02d-%02d", now.year, now.month,
+           now.day);
+  WriteText(out, font_6x9, 2, 10, buffer);
+
+  snprintf(buffer, sizeof(buffer), "%02d:%02d", now.hour, now.min);
+  WriteText(out, font_timetext, 2, 22, buffer);
+}
+
+// Clock as drawn by DrawTime(), described by a display list instead: the
+// rows are drawn one by one while printing, so a new minute needs nothing
+// drawn before the pull starts. Within the same minute, the list made
+// before is shown again, and a frame core1 drew it into keeps its rows. A
+// new minute is drawn anew as a whole on core1: a few microseconds, not
+// worth tracking which glyphs changed.
+static void ClockContent(FrameBuffer *out) {
+  datetime_t now{};
+  if (!rtc_get_datetime(&now)) {
+    out->StartDisplayList(ScreenAspect::kAlongWidth)
+        .AddText(font_6x9, 2, 0, "Set Time!");
+    return;
   }
-  WriteText(out, &font_6x9, 62, 0, weekday, true);
+  // Minutes since year 0; never zero.
+  const uint32_t minute =
+      (((now.year * 12u + now.month) * 31 + now.day) * 24 + now.hour) * 60 +
+      now.min + 1;
+  if (out->ReuseDisplayList(minute)) return;
+  FrameBuffer::DisplayList_t &list =
+      out->StartDisplayList(ScreenAspect::kAlongWidth, minute);
+  list.AddText(font_6x9, FrameBuffer::kColumns - 2, 0, WeekdayName(now.dotw),
+               true);
 
   char buffer[32];
   snprintf(buffer, sizeof(buffer), "%4d-%02d-%02d", now.year, now.month,
            now.day);
-  WriteText(out, &font_6x9, 2, 10, buffer);
+  list.AddText(font_6x9, 2, 10, buffer);
 
   snprintf(buffer, sizeof(buffer), "%02d:%02d", now.hour, now.min);
-  WriteText(out, &font_timetext, 2, 22, buffer);
+  list.AddText(font_timetext, 2, 22, buffer);
+}
+
+// Bitmaps are prepared at compile time and printed right from flash.
+static constexpr auto kJollyWrencherRows =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kJollyWrencherBitmap)>(
+        kJollyWrencherBitmap);
+static constexpr auto kProjectQRRows =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kProjectQRBitmap)>(
+        kProjectQRBitmap);
+
+// Static text is rendered at compile time as well.
+static constexpr auto kNameImage = [] {
+  RowImage<15 + font_message.height> image(ScreenAspect::kAlongWidth);
+  WriteText(&image, font_message, 2, 0, "Henner", false, 2);
+  WriteText(&image, font_message, FrameBuffer::kColumns - 2, 15, "Zeller",
+            true, 2);
+  return image;
+}();
+static constexpr auto kNameRows =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kNameImage.rows)>(
+        kNameImage.rows);
+
+static constexpr auto kSuperconImage = [] {
+  RowImage<TextWidth(font_large, "Supercon 8")> image(
+      ScreenAspect::kAlongLength);
+  WriteText(&image, font_large, 0, 8, "Supercon 8");
+  return image;
+}();
+static constexpr auto kSuperconRows =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kSuperconImage.rows)>(
+        kSuperconImage.rows);
+
+// Gray wedge: bands across the tape, each a level brighter than the one
+// before, to see how the glow follows the exposure.
+static constexpr auto kGrayWedgeImage = [] {
+  constexpr int kColumns = FrameBuffer::kColumns;
+  GrayImage<64> image(ScreenAspect::kAlongWidth);
+  for (int y = 0; y < 64; ++y) {
+    for (int x = 0; x < kColumns; ++x) {
+      image.SetPixel(x, y, x * kGrayLevels / kColumns);
+    }
+  }
+  return image;
+}();
+static constexpr auto kGrayWedgePlane0 =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kGrayWedgeImage.planes[0])>(
+        kGrayWedgeImage.planes[0]);
+static constexpr auto kGrayWedgePlane1 =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kGrayWedgeImage.planes[1])>(
+        kGrayWedgeImage.planes[1]);
+static constexpr auto kGrayWedgePlane2 =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kGrayWedgeImage.planes[2])>(
+        kGrayWedgeImage.planes[2]);
+static constexpr GrayFrame kGrayWedge = {{
+    kGrayWedgePlane0.data(),
+    kGrayWedgePlane1.data(),
+    kGrayWedgePlane2.data(),
+}};
+static_assert(kGrayPlanes == 3, "Prepare each plane of kGrayWedge");
+
+// Content, selected by number of button presses.
+enum Content {
+  kTime,  // Default: no button presses
+  kName,
+  kJollyWrencher,
+  kSupercon,
+  kProject,
+  kStored,  // Images uploaded to flash; more presses: the next ones.
+};
+
+// Images uploaded over serial, see UploadPacket().
+static FlashStore *stored_images = nullptr;
+
+// One press past the last stored image: the gray wedge, printed as
+// kGrayWedge. After them, so that stored images keep their presses. Also
+// from core1.
+static bool IsGrayscale(int what_content) {
+  if (what_content < kStored) return false;
+  return what_content == kStored + (stored_images ? stored_images->size() : 0);
+}
+
+// Copy of the image selected; false if that is not a stored image. Also
+// from core1.
+static bool StoredImage(int what_content, FlashStore::Image *image) {
+  return stored_images && what_content >= kStored &&
+         stored_images->Get(what_content - kStored, image);
 }
 
 // Create content, derived from number of button presses before.
-void CreateContent(FramePrinter *out, int what_content) {
-  enum Content {
-    kTime,  // Default: no button presses
-    kName,
-    kJollyWrencher,
-    kSupercon,
-    kProject,
-  };
+void CreateContent(FrameBuffer *out, int what_content) {
+  FlashStore::Image image;
+  if (StoredImage(what_content, &image)) {
+    out->UsePrepared(image.rows);  // Printed right from flash.
+    return;
+  }
 
   out->StartNewImage(ScreenAspect::kAlongWidth);
 
   if (what_content == kJollyWrencher) {
-    for (uint64_t row : kJollyWrencherBitmap) {
-      out->push_back(row);
-    }
+    out->UsePrepared(kJollyWrencherRows.data());
     return;
   }
 
   if (what_content == kName) {
-    WriteText(out, &font_message, 2, 0, "Henner", false, 2);
-    WriteText(out, &font_message, 62, 15, "Zeller", true, 2);
+    out->UsePrepared(kNameRows.data());
     return;
   }
 
   if (what_content == kSupercon) {
-    out->StartNewImage(ScreenAspect::kAlongLength);
-    WriteText(out, &font_large, 0, 8, "Supercon 8");
+    out->UsePrepared(kSuperconRows.data());
     return;
   }
 
   if (what_content == kProject) {
-    for (uint64_t row : kProjectQRBitmap) {
-      out->push_back(row);
-    }
+    out->UsePrepared(kProjectQRRows.data());
+    return;
+  }
+
+  if (IsGrayscale(what_content)) {  // 1-bit: just the most significant.
+    out->UsePrepared(kGrayWedge.planes[0]);
     return;
   }
 
   // None of the above ? Ok, time then.
-  DrawTime(out);
+  ClockContent(out);
 }
 
+// -- Content rendered ahead of time on core1.
+//
+// Frames rotate between the cores through two queues. Core1 renders the
+// content currently selected with the button into a frame it owns and sends
+// it to core0, tagged with the content number. Core0 holds on to the latest
+// one and swaps it in on the first tick of a pull if it matches the
+// selection. Frames that are outdated or done printing go back to core1.
+// Core1 starts out owning two of the three frames, so it always has one to
+// render into while core0 holds the latest. Not the multicore FIFO: the
+// lockout that pauses core1 while flash is written drains it.
+static FrameBuffer frames[3];
+
+// Version of the content in each frame, see ContentVersion(); set by core1
+// before it sends the frame. A stored image's rows might have been moved
+// and erased if the version is not the current one.
+static std::atomic<int> frame_versions[3];
+
+// Messages: index of the frame in the lower bits; frames sent to core0 have
+// the content number above that, frames sent to core1 the kFrameUsed flag.
+constexpr uint32_t kFrameIndexMask = 0x3;
+constexpr uint32_t kFrameUsed = 0x4;  // Printed, so render content again.
+constexpr int kContentShift = 2;
+static queue_t to_core0;
+static queue_t to_core1;
+
+// Content selected by button presses as last seen by core0.
+static std::atomic<int> selected_content{0};
+
+// Rendered content only changes with time if it shows the clock: the minute
+// it was rendered for. -1 for the clock while RTC is not set yet. Taken
+// before rendering: stored images might change in between.
+static int ContentVersion(int what_content) {
+  const uint32_t generation = stored_images ? stored_images->generation() : 0;
+  FlashStore::Image image;
+  // Which press is the gray wedge changes with the stored images, too.
+  if (StoredImage(what_content, &image) || IsGrayscale(what_content)) {
+    return generation;
+  }
+  if (what_content >= kName && what_content < kStored) return 0;  // Static
+  datetime_t now{};
+  if (!rtc_get_datetime(&now)) return -1;
+  return now.hour * 60 + now.min;
+}
+
+static void Core1Prerender() {
+  multicore_lockout_victim_init();  // Paused while writing flash.
+  int free_frames[2] = {1, 2};
+  int free_count = 2;
+  int rendered_content = -1;
+  int rendered_version = -1;
+  for (;;) {
+    uint32_t msg;
+    while (queue_try_remove(&to_core1, &msg)) {
+      free_frames[free_count++] = msg & kFrameIndexMask;
+      if (msg & kFrameUsed) rendered_content = -1;  // Next pull needs one.
+    }
+    const int content = selected_content.load(std::memory_order_relaxed);
+    const int version = ContentVersion(content);
+    if ((content == rendered_content && version == rendered_version) ||
+        free_count == 0) {
+      sleep_ms(1);
+      continue;
+    }
+    const int index = free_frames[--free_count];
+    CreateContent(&frames[index], content);
+    frames[index].DrawDisplayList();  // There is time; printing is faster.
+    frames[index].Finalize();
+    frame_versions[index].store(version, std::memory_order_release);
+    msg = content << kContentShift | index;
+    queue_add_blocking(&to_core0, &msg);
+    rendered_content = content;
+    rendered_version = version;
+  }
+}
+
+// Core0 side of the frame exchange.
+class ContentFrames {
+ public:
+  ContentFrames() {
+    if (!kPrerenderOnCore1) return;
+    // Never full: there are only as many messages as frames.
+    queue_init(&to_core0, sizeof(uint32_t), 3);
+    queue_init(&to_core1, sizeof(uint32_t), 3);
+    multicore_launch_core1(&Core1Prerender);
+  }
+
+  // To be called regularly. Tells core1 the content to prepare and picks up
+  // frames it rendered. Given a printer, core1 renders more of the content
+  // it prints instead, and each new frame is committed to follow the one
+  // printing after kRepeatGapRows.
+  void Poll(int what_content, FramePrinter *repeat = nullptr) {
+    if (!kPrerenderOnCore1) return;
+    if (committed_frame_ >= 0 && repeat &&
+        repeat->frame() == &frames[committed_frame_]) {  // Swapped in.
+      previous_frame_ = current_frame_;
+      current_frame_ = committed_frame_;
+      committed_frame_ = -1;
+    }
+    if (previous_frame_ >= 0) {  // Printer moved on to the current frame.
+      Send(previous_frame_ | kFrameUsed);
+      previous_frame_ = -1;
+    }
+    selected_content.store(repeat ? current_content_ : what_content,
+                           std::memory_order_relaxed);
+    uint32_t msg;
+    while (queue_try_remove(&to_core0, &msg)) {
+      if (ready_frame_ >= 0) Send(ready_frame_);
+      ready_frame_ = msg & kFrameIndexMask;
+      ready_content_ = msg >> kContentShift;
+    }
+    if (repeat && committed_frame_ < 0 && Ready(current_content_) &&
+        repeat->frame() == &frames[current_frame_]) {
+      committed_frame_ = ready_frame_;
+      ready_frame_ = -1;
+      repeat->Commit(&frames[committed_frame_], -kRepeatGapRows);
+    }
+  }
+
+  // Frame with the given content to print next. Rendered right away if
+  // core1 does not have it ready. The frame printed before is handed back
+  // to core1 in the next Poll(), once the printer has moved on.
+  FrameBuffer *Next(int what_content) {
+    if (committed_frame_ >= 0) {  // Not swapped in; as good as ready.
+      if (ready_frame_ < 0) {
+        ready_frame_ = committed_frame_;
+        ready_content_ = current_content_;
+      } else {
+        Send(committed_frame_);
+      }
+      committed_frame_ = -1;
+    }
+    if (Ready(what_content)) {
+      previous_frame_ = current_frame_;
+      current_frame_ = ready_frame_;
+      ready_frame_ = -1;
+    } else {
+      CreateContent(&frames[current_frame_], what_content);
+    }
+    current_content_ = what_content;
+    return &frames[current_frame_];
+  }
+
+ private:
+  static void Send(uint32_t msg) { queue_add_blocking(&to_core1, &msg); }
+
+  // A frame of the content is ready, and it is still current.
+  bool Ready(int what_content) const {
+    return ready_frame_ >= 0 && ready_content_ == what_content &&
+           frame_versions[ready_frame_].load(std::memory_order_acquire) ==
+               ContentVersion(what_content);
+  }
+
+  int current_frame_ = 0;   // Frame printed by core0.
+  int current_content_ = 0;
+  int previous_frame_ = -1;  // To be returned to core1.
+  int ready_frame_ = -1;     // Latest frame prerendered by core1.
+  int ready_content_ = -1;
+  int committed_frame_ = -1;  // Handed to the printer, not swapped in yet.
+};
+
 static void TimeSetter(const char *value) {
   int year, month, day, hour, min, sec, day_of_week;
   int count = sscanf(value, "%d-%d-%d %d:%d:%d %d\n", &year, &month, &day,
@@ -150,47 +467,461 @@ static void TimeSetter(const char *value) {
   }
 }
 
+static TickTrace<kTraceTicks> tick_trace;
+IdlePower idle_power;  // Not static: the simulation shows its numbers.
+
+// Work of the main loop, by priority: each tick is handled before anything
+// else that is waiting. See task-scheduler.h
+enum MainTask {
+  kTickTask,     // Encoder ticks: print rows, time flashes.
+  kContentTask,  // Hand content to core1 and pick up what it rendered.
+  kSerialTask,   // Commands and image upload.
+  kButtonTask,
+  kStoreTask,    // Write uploaded images to flash.
+  kMainTasks,
+};
+using MainScheduler = TaskScheduler<kMainTasks>;
+static MainScheduler *scheduler = nullptr;  // For interrupts and "stats".
+static FramePrinter *edge_printer = nullptr;  // For the encoder interrupt.
+
+static bool repeat_content = false;
+
+// With the "halfrows on" serial command, a row interpolated between two rows
+// is flashed halfway between their ticks, while the pull is steady and slow
+// enough for flashes half as long. Single channel encoder only.
+static bool half_rows = false;
+
+// Text commands on the serial line. Anything else is the time to set.
+static void SerialCommand(const char *line) {
+  if (strcmp(line, "trace") == 0) {
+    tick_trace.Dump();
+  } else if (strcmp(line, "stats") == 0) {
+    tick_trace.PrintStats();
+    idle_power.PrintStats();
+    if (scheduler) scheduler->PrintStats();
+  } else if (strcmp(line, "clear") == 0) {
+    tick_trace.Clear();
+    printf("\nOK\n");
+  } else if (strcmp(line, "repeat on") == 0 ||
+             strcmp(line, "repeat off") == 0) {
+    repeat_content = (strcmp(line, "repeat on") == 0);
+    printf("\nOK\n");
+  } else if (strcmp(line, "halfrows on") == 0 ||
+             strcmp(line, "halfrows off") == 0) {
+    half_rows = (strcmp(line, "halfrows on") == 0);
+    printf("\nOK\n");
+  } else {
+    TimeSetter(line);
+  }
+}
+
+// -- Image upload with binary packets, see packet-reader.h and
+// upload-image.py. Packet types:
+constexpr uint8_t kUploadBegin = 'B';  // Start new image; data: its name.
+constexpr uint8_t kUploadRows = 'R';   // Append rows, 8 bytes per panel, LE.
+constexpr uint8_t kUploadEnd = 'E';    // Done; store in flash.
+constexpr uint8_t kUploadDelete = 'D';  // Delete image; data: its name.
+constexpr uint8_t kStreamRows = 'S';  // Rows to print as they come, as 'R'.
+constexpr uint8_t kStreamEnd = 'Q';   // No more rows; data: 1 to drop the
+                                      // rows not printed yet.
+constexpr int kMaxUploadRowsPerPacket = 64 / kPanelCount;
+constexpr int kUploadRowBytes = sizeof(FrameBuffer::RowBits_t);
+
+// The flash store is only written while not pulling for this long.
+constexpr int64_t kStoreIdleUsec = 2'000'000;
+
+using SerialPackets =
+    PacketReader<kMaxUploadRowsPerPacket * kUploadRowBytes>;
+
+// Bytes read from serial per run of its task, then other tasks get a turn.
+constexpr int kSerialBytesPerPoll = 64;
+
+// Rows streamed from the host while pulling; see FramePrinter.
+static FrameBuffer::RowStream_t live_stream;
+
+// The content frames, the upload frame and the stream take most of the 264KB
+// of RAM; the rest is left for stacks, the SDK and the flash store.
+static_assert(sizeof(frames) + sizeof(FrameBuffer) + sizeof(live_stream) <=
+                  192 * 1024,
+              "Frames and stream must fit into RAM");
+
+// Row of packet data: 8 bytes per panel, little endian.
+static FrameBuffer::RowBits_t PacketRow(const uint8_t *data) {
+  FrameBuffer::RowBits_t row{};
+  for (int w = 0; w < kPanelCount; ++w, data += 8) {
+    uint64_t &word = RowWord(row, w);
+    for (int i = 7; i >= 0; --i) word = word << 8 | data[i];
+  }
+  return row;
+}
+
+// Handle stream packet. The first rows start the stream; rows without data
+// just ask for credit. The reply is the credit, rows free in the queue, and
+// the underruns so far, both 16 bits LE. Rows beyond the credit are
+// refused as busy, to be sent again. Only with the single channel encoder:
+// the tape can't go back to rows printed already.
+static SerialPackets::Status StreamPacket(uint8_t type, uint8_t seq,
+                                          const uint8_t *data, size_t len,
+                                          uint8_t *reply, size_t *reply_len) {
+  static int last_packet = -1;  // Type and seq; resent if the ack got lost.
+  static SerialPackets::Status last_status;
+
+  if (kQuadratureEncoder) return SerialPackets::kUnknownType;
+  if ((type << 8 | seq) != last_packet) {  // Don't apply twice.
+    last_packet = type << 8 | seq;
+    last_status = SerialPackets::kOk;
+    if (type == kStreamEnd) {
+      live_stream.End();
+      if (len > 0 && data[0]) live_stream.Drop();
+    } else if (len % kUploadRowBytes != 0) {
+      last_status = SerialPackets::kBadPacket;
+    } else if ((int)(len / kUploadRowBytes) > live_stream.free()) {
+      last_status = SerialPackets::kBusy;
+      last_packet = -1;  // Host will retry.
+    } else {
+      if (len > 0 && !live_stream.live()) live_stream.Start();
+      for (/**/; len > 0; len -= kUploadRowBytes, data += kUploadRowBytes) {
+        live_stream.Push(PacketRow(data));
+      }
+    }
+  }
+  const int free = live_stream.free();
+  const uint32_t underruns = std::min(live_stream.underruns(), 0xffffu);
+  reply[0] = free & 0xff;
+  reply[1] = free >> 8;
+  reply[2] = underruns & 0xff;
+  reply[3] = underruns >> 8;
+  *reply_len = 4;
+  return last_status;
+}
+
+// Handle upload packet. The reply is the number of rows received so far.
+static SerialPackets::Status UploadPacket(uint8_t type, uint8_t seq,
+                                          const uint8_t *data, size_t len,
+                                          uint8_t *reply, size_t *reply_len) {
+  static FrameBuffer uploaded_frame;  // Until written to flash.
+  static char name[FlashStore::kNameSize];
+  static bool receiving = false;
+  // Type and seq of the packet before: resent if the ack got lost. Each run
+  // of the host starts at a random seq, so that its first packets are not
+  // taken for those of the run before.
+  static int last_packet = -1;
+  static SerialPackets::Status last_status;
+  static int rows = 0;
+
+  if (type == kStreamRows || type == kStreamEnd) {
+    return StreamPacket(type, seq, data, len, reply, reply_len);
+  }
+  if ((type << 8 | seq) != last_packet) {  // Don't apply twice.
+    last_packet = type << 8 | seq;
+    last_status = SerialPackets::kOk;
+    switch (type) {
+      case kUploadBegin:
+      case kUploadDelete:
+        if (stored_images->busy()) {  // Previous upload not in flash yet.
+          last_status = SerialPackets::kBusy;
+          last_packet = -1;  // Host will retry.
+          break;
+        }
+        snprintf(name, sizeof(name), "%.*s", (int)len, (const char *)data);
+        if (type == kUploadDelete) {
+          if (!stored_images->Delete(name)) {
+            last_status = SerialPackets::kNotFound;
+          }
+          break;
+        }
+        uploaded_frame.StartNewImage(ScreenAspect::kAlongWidth);
+        receiving = true;
+        rows = 0;
+        break;
+
+      case kUploadRows:
+        if (!receiving) {
+          last_status = SerialPackets::kOutOfOrder;
+        } else if (len % kUploadRowBytes != 0) {
+          last_status = SerialPackets::kBadPacket;
+        } else {
+          for (/**/; len > 0; len -= kUploadRowBytes, ++rows) {
+            uploaded_frame.push_back(PacketRow(data));
+            data += kUploadRowBytes;
+          }
+          if (uploaded_frame.full()) last_status = SerialPackets::kOutOfSpace;
+        }
+        break;
+
+      case kUploadEnd:
+        if (!receiving) {
+          last_status = SerialPackets::kOutOfOrder;
+          break;
+        }
+        uploaded_frame.Finalize();
+        receiving = false;
+        if (uploaded_frame.full() ||
+            !stored_images->Save(name, uploaded_frame.physical_rows())) {
+          last_status = SerialPackets::kOutOfSpace;
+        }
+        break;
+
+      default:
+        last_status = SerialPackets::kUnknownType;
+    }
+  }
+  reply[0] = rows & 0xff;
+  reply[1] = rows >> 8;
+  *reply_len = 2;
+  return last_status;
+}
+
 int main() {
   stdio_init_all();  // Init serial, such as uart or usb
   rtc_init();
 
   // Peripherals
-  LineReader<256> process_serial(&TimeSetter);
-  StripEncoder encoder;
+  LineReader<256> process_serial(&SerialCommand);
+  SerialPackets process_packets(&UploadPacket,
+                                [&](char c) { process_serial.Feed(c); });
+  StripEncoder encoder(kQuadratureEncoder);
   ButtonCounter button(kButtonPin);
-  FramePrinter printer(kSpiTxPin, spi1);  // 0.8mm * 1024 ≈ 82cm
+#if GLOWTAPE_PIO_LANES
+  FramePrinter printer(kSpiTxPin, pio0);
+#else
+  FramePrinter printer(kSpiTxPin, spi1);
+#endif
+  static FlashStore store(kPrerenderOnCore1);  // Outlives main(), as core1.
+  stored_images = &store;
+  ContentFrames content;
 
-  int16_t fast_steps = 0;
-  int16_t forward_steps = 0;
-  for (;;) {
-    process_serial.Poll();
-    button.Poll();
+  TickPredictor predictor;
 
-    switch (encoder.Poll()) {
-      case StripEncoder::Result::kFirstTick:
-        CreateContent(&printer, button.count());
-        printer.SendStart();
-        fast_steps = forward_steps = 0;
-        button.Reset();
-        break;
+  // Start printing the content selected with the button, or rows streamed
+  // from the host, continuing the stream of the last pull.
+  auto start_image = [&]() {
+    if (printer.streaming()) {
+      // Keep going.
+    } else if (live_stream.live() || live_stream.queued() > 0) {
+      printer.SendStart(&live_stream);
+    } else if (IsGrayscale(button.count())) {
+      printer.SendStart(kGrayWedge);
+    } else {
+      printer.SendStart(content.Next(button.count()));
+    }
+    button.Reset();
+  };
 
-      case StripEncoder::Result::kFastTick:
-        ++fast_steps;  // If we see more than 4 of these, stop sending anything.
-        if (forward_steps > 4 && fast_steps < 4 && printer.SendNext()) {
-          printer.LightFlash(kFlashTimeMillis);
-        }
+  // Make a row ready with send() and flash it if it is part of the image.
+  auto print_row = [&](auto send, uint32_t flash_usec) {
+    const uint32_t send_start = tick_trace.Now();
+    const bool more = send();
+    tick_trace.Sent(send_start, more, printer);
+    if (!more) return;
+    printer.LightFlash(flash_usec);
+    tick_trace.Flash(printer, flash_usec);
+    printer.DrawAhead();  // While the LEDs are on.
+  };
+
+  // Single channel: each edge prints the next row. Once the predictor is
+  // locked, the row for the next edge is made ready as soon as the flash
+  // before is over, and flashed by the edge interrupt; only the edge places
+  // a row, so one made ready stays dark while the tape stops. Until then,
+  // and whenever the lock is lost, rows are flashed as their edge is seen.
+  bool following = false;  // Predictor locked on in this pull.
+  int32_t edges = 0;       // Edges since.
+  int32_t row_edge = 0;    // Edge of the row made ready last.
+  bool row_lit = false;    // That row is flashed.
+  bool half_done = false;  // Half row after it flashed or skipped.
+  uint32_t row_flash_usec = 0;
+
+  // Half rows are printed for the current speed.
+  auto halving = [&]() {
+    return half_rows && predictor.steady() &&
+           RoomForHalfRows(predictor.interval_usec());
+  };
+  auto flash_usec = [&]() {
+    const int32_t interval = predictor.interval_usec();
+    return FlashTimeUsec(halving() ? interval / 2 : interval);
+  };
+
+  // Set up the flash of what comes after the row of the last edge: the half
+  // row, then the row of the next edge. Called after each edge and flash.
+  auto arm_next = [&]() {
+    if (!following || !predictor.locked() || row_edge != edges) return;
+    if (printer.flash_active() || printer.flash_armed()) return;
+    if (!half_done) {
+      half_done = true;
+      if (halving() && printer.SendHalfRowAt(predictor.half_row(),
+                                             flash_usec())) {
+        tick_trace.HalfRow(printer);
+        return;
+      }
+    }
+    row_flash_usec = flash_usec();
+    const uint32_t send_start = tick_trace.Now();
+    row_lit = printer.SendNextArmed(row_flash_usec);
+    tick_trace.Sent(send_start, row_lit, printer);
+    if (row_lit) printer.DrawAhead();  // Before and while the LEDs are on.
+    ++row_edge;
+    half_done = false;
+  };
+
+  // Edge seen: its row is flashed now, unless the flash was set up already.
+  auto print_next_row = [&]() {
+    if (!predictor.Edge(encoder.last_tick_time())) {
+      tick_trace.Skipped();  // Glitch.
+      return;
+    }
+    if (!following) {
+      if (!predictor.locked()) {
+        tick_trace.Skipped();
+        return;
+      }
+      following = true;
+      edges = 0;
+      row_edge = -1;
+    } else {
+      ++edges;
+    }
+    if (row_edge == edges) {
+      if (!row_lit) return;
+      printer.FlashNow();
+      tick_trace.Flash(printer, row_flash_usec);
+      return;
+    }
+    row_edge = edges;
+    half_done = false;
+    print_row([&]() { return printer.SendNext(); }, flash_usec());
+  };
+
+  // Quadrature: flash the row at the tape position. After a pause, the
+  // image continues where it was, unless it is done or the button was
+  // pressed to choose new content. A stored image is looked up again if
+  // the store changed in the pause: its rows might have been moved and
+  // erased.
+  int32_t image_start = 0;  // Position of the first tick of the image.
+  bool image_done = true;   // Tape moved past its end.
+  int image_content = -1;   // Stored image printing, if any.
+  uint32_t image_generation = 0;
+  auto print_at_position = [&](StripEncoder::Result result) {
+    if (result == StripEncoder::Result::kFirstTick) {
+      if (image_done || button.count() > 0) {
+        const int what_content = button.count();
+        start_image();
+        image_start = encoder.position();
+        FlashStore::Image image;
+        const bool stored =
+            !printer.streaming() && StoredImage(what_content, &image);
+        image_content = stored ? what_content : -1;
+      } else if (image_content >= 0 &&
+                 store.generation() != image_generation) {
+        printer.SendStart(content.Next(image_content));
+      }
+      image_generation = store.generation();
+    }
+    const int row = printer.rows() - 1 -
+                    (encoder.position() - image_start - kLeadRows);
+    image_done = row < 0;
+    print_row([&]() { return printer.SendRow(row); },
+              FlashTimeUsec(encoder.tick_interval_usec()));
+  };
+
+  // One tick at a time, so that a tick is never waiting behind another task
+  // for longer than one of its runs.
+  auto handle_tick = [&]() {
+    if (idle_power.Wake()) {  // Back to full clock for the pull.
+      printer.ClockChanged();
+    }
+    const StripEncoder::Result result = encoder.Poll();
+    if (encoder.edge_pending()) scheduler->Post(kTickTask);
+    if (result == StripEncoder::Result::kFirstTick) {
+      idle_power.FirstTick(encoder.last_tick_time());
+    }
+    if (result != StripEncoder::Result::kNoTick) {
+      tick_trace.Tick(encoder, result);
+    }
+    if (kQuadratureEncoder) {
+      if (result != StripEncoder::Result::kNoTick) print_at_position(result);
+      return;
+    }
+    switch (result) {
+      case StripEncoder::Result::kFirstTick:
+        start_image();
+        predictor.Start(encoder.last_tick_time());
+        following = false;
         break;
 
+      case StripEncoder::Result::kFastTick:  // Just a tick to the predictor.
       case StripEncoder::Result::kTick:
-        ++forward_steps;  // Want to see first if consistent stream of ticks.
-        if (forward_steps > 4 && fast_steps < 4 && printer.SendNext()) {
-          printer.LightFlash(kFlashTimeMillis);
-        }
+        print_next_row();
         break;
 
-      case StripEncoder::Result::kNoTick:
-        // Nothing to do.
+      case StripEncoder::Result::kNoTick:  // E.g. woken up by a flash ending.
+      case StripEncoder::Result::kBackTick:  // Only in quadrature mode.
         break;
     }
+    arm_next();
+  };
+
+  auto idle_usec = [&]() {
+    return absolute_time_diff_us(encoder.last_tick_time(), get_absolute_time());
+  };
+
+  // Budgets are what a run normally takes at most; "stats" shows the runs
+  // that took longer. A first tick may render the content, printing stats
+  // and writing flash take long.
+  MainScheduler tasks({
+      {"tick", 1'000, 0, handle_tick},
+      {"content", 500, kTaskPollUsec,
+       [&]() {
+         const bool repeat = repeat_content && !kQuadratureEncoder &&
+                             idle_usec() < kPullIdleUsec;
+         content.Poll(button.count(), repeat ? &printer : nullptr);
+       }},
+      {"serial", 2'000, kTaskPollUsec,
+       [&]() {
+         bool more = true;
+         for (int i = 0; i < kSerialBytesPerPoll && more; ++i) {
+           if (scheduler->Preempted()) break;
+           const int c = getchar_timeout_us(0);
+           more = (c >= 0);
+           if (more) {
+             process_packets.Feed(c);
+           } else {
+             process_packets.Idle();
+           }
+         }
+         process_packets.SendAck();
+         if (more) scheduler->Post(kSerialTask);  // There may be more.
+       }},
+      {"button", 100, kTaskPollUsec,
+       [&]() {
+         const int count = button.count();
+         button.Poll();
+         if (button.count() != count) scheduler->Post(kContentTask);
+       }},
+      {"store", 60'000, kTaskPollUsec,
+       [&]() {
+         if (idle_usec() > kStoreIdleUsec) {
+           store.Poll();  // Stalls everything while writing flash.
+         }
+       }},
+  });
+  scheduler = &tasks;
+  edge_printer = &printer;
+  encoder.set_edge_notify([]() {
+    edge_printer->FlashNow();  // Row made ready for this edge, if any.
+    scheduler->Post(kTickTask);
+  });
+  printer.set_flash_notify([]() { scheduler->Post(kTickTask); });
+  stdio_set_chars_available_callback(
+      [](void *) { scheduler->Post(kSerialTask); }, nullptr);
+
+  for (;;) {
+    if (tasks.RunNext()) continue;
+    // Nothing to do until the next interrupt. Between pulls, at low clock.
+    if (tasks.Pending()) continue;
+    if (idle_usec() > kPullIdleUsec) {
+      idle_power.Sleep(tasks.UsecUntilDue());
+    } else {
+      idle_power.Wait(tasks.UsecUntilDue());
+    }
   }
 }
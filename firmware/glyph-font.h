@@ -0,0 +1,99 @@
+#ifndef GLYPH_FONT_H
+#define GLYPH_FONT_H
+
+#include <cstdint>
+
+#include "panel-row.h"
+
+// Font data generated from BDF fonts by make-glyph-font.py.
+//
+// Each glyph is stored pre-rotated for both ScreenAspects, so that it can be
+// drawn with FrameBuffer::BlitAlongRow(), touching each row of the tape once
+// per glyph instead of once per pixel:
+//   scanlines: per pixel row of the glyph, words_per_scanline words, leftmost
+//              pixel in bit 63. Used for kAlongWidth.
+//   columns:   per pixel column of the glyph, words_per_column words, topmost
+//              pixel in bit 0. Used for kAlongLength.
+struct Glyph {
+  uint16_t codepoint;
+  uint8_t width;
+  uint32_t scanlines;  // Offsets into GlyphFont::bits
+  uint32_t columns;
+};
+
+struct GlyphFont {
+  uint8_t height;
+  uint8_t words_per_scanline;
+  uint8_t words_per_column;
+  uint16_t glyph_count;
+  const Glyph *glyphs;  // Sorted by codepoint.
+  const uint64_t *bits;
+
+  // Returns glyph or nullptr if not available in this font.
+  constexpr const Glyph *Find(uint16_t codepoint) const {
+    int lo = 0;
+    int hi = glyph_count;
+    while (lo < hi) {
+      const int mid = (lo + hi) / 2;
+      if (glyphs[mid].codepoint < codepoint) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return (lo < glyph_count && glyphs[lo].codepoint == codepoint)
+               ? &glyphs[lo]
+               : nullptr;
+  }
+};
+
+// Draw glyph with its top left corner at (x, y); returns its width. Draws
+// on a FrameBuffer or, at compile time, on a RowImage.
+template <typename Canvas>
+constexpr int DrawGlyph(Canvas *out, const GlyphFont &font, int x, int y,
+                        uint16_t codepoint) {
+  const Glyph *glyph = font.Find(codepoint);
+  if (!glyph) return 0;
+  if (out->aspect() == ScreenAspect::kAlongLength) {
+    const uint64_t *column = font.bits + glyph->columns;
+    for (int gx = 0; gx < glyph->width; ++gx) {
+      for (int word = 0; word < font.words_per_column; ++word) {
+        out->BlitAlongRow(x + gx, y + 64 * word, *column++);
+      }
+    }
+  } else {
+    const uint64_t *scanline = font.bits + glyph->scanlines;
+    for (int gy = 0; gy < font.height; ++gy) {
+      for (int word = 0; word < font.words_per_scanline; ++word) {
+        out->BlitAlongRow(x + 64 * word, y + gy, *scanline++);
+      }
+    }
+  }
+  return glyph->width;
+}
+
+// Width of text in pixels, with extra_space after each character.
+constexpr int TextWidth(const GlyphFont &font, const char *text,
+                        int extra_space = 0) {
+  int width = 0;
+  for (const char *txt = text; *txt; ++txt) {
+    const Glyph *g = font.Find(*txt);
+    if (g) width += g->width;
+    width += extra_space;
+  }
+  return width;
+}
+
+// Write text starting at (xpos, ypos), or ending there if right_aligned.
+template <typename Canvas>
+constexpr void WriteText(Canvas *out, const GlyphFont &font, int xpos,
+                         int ypos, const char *print_text,
+                         bool right_aligned = false, int extra_space = 0) {
+  if (right_aligned) xpos -= TextWidth(font, print_text, extra_space);
+  for (const char *txt = print_text; *txt; ++txt) {
+    xpos += DrawGlyph(out, font, xpos, ypos, *txt);
+    xpos += extra_space;
+  }
+}
+
+#endif  // GLYPH_FONT_H
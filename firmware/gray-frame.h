@@ -0,0 +1,49 @@
+#ifndef GRAY_FRAME_H
+#define GRAY_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "frame-buffer.h"
+#include "row-store.h"
+
+// Glow tape brightness follows the UV dose, so pixels can have levels: a
+// grayscale image is kept as bit-planes, each a 1-bit image of the same
+// length, most significant first. FramePrinter exposes the planes of a row
+// one after the other, each for half the time of the one before.
+constexpr int kGrayPlanes = 3;
+constexpr int kGrayLevels = 1 << kGrayPlanes;
+
+// Finalized rows of each plane, e.g. prepared with FrameBuffer::Prepare().
+struct GrayFrame {
+  RowData planes[kGrayPlanes];
+};
+
+// Grayscale image drawn at compile time, to be turned into rows plane by
+// plane with FrameBuffer::Prepare(). Pixels beyond kRows are dropped.
+template <size_t kRows, int kPanels = kPanelCount>
+struct GrayImage {
+  using Frame = BasicFrameBuffer<kPanels>;
+
+  constexpr explicit GrayImage(ScreenAspect type) : aspect_type(type) {}
+
+  // Set pixel (x, y) to level 0 (dark) ... kGrayLevels - 1 (full glow).
+  constexpr void SetPixel(int x, int y, int level) {
+    const uint64_t bit =
+        aspect_type == ScreenAspect::kAlongWidth ? 1ULL << 63 : 1;
+    int row = 0;
+    typename Frame::RowBits_t bits{};
+    if (!AlongRow(aspect_type, x, y, bit, &row, &bits) || row < 0 ||
+        row >= static_cast<int>(kRows)) {
+      return;
+    }
+    for (int p = 0; p < kGrayPlanes; ++p) {
+      if (level & (kGrayLevels >> (p + 1))) planes[p][row] |= bits;
+    }
+  }
+
+  ScreenAspect aspect_type;
+  typename Frame::RowBits_t planes[kGrayPlanes][kRows] = {};
+};
+
+#endif  // GRAY_FRAME_H
@@ -0,0 +1,16 @@
+#ifndef _HARDWARE_CLOCKS_H
+#define _HARDWARE_CLOCKS_H
+
+#include "pico/types.h"
+
+enum clock_index { clk_sys = 5 };
+
+// The default 125MHz system clock, or what it was set to.
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+// Only the system clock is simulated; the cost of HAL calls done by the CPU
+// scales with it. Changing it takes a PLL relock, see sim::CallCost.
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+void set_sys_clock_48mhz();
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _HARDWARE_DMA_H
+#define _HARDWARE_DMA_H
+
+#include "pico/types.h"
+
+// DMA only knows about transfers to SPI data registers and PIO TX FIFOs;
+// those are forwarded to the simulated SPI or PIO with the timing of the
+// shift-out.
+
+enum dma_channel_transfer_size {
+  DMA_SIZE_8 = 0,
+  DMA_SIZE_16 = 1,
+  DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+  enum dma_channel_transfer_size size;
+  bool read_increment;
+  bool write_increment;
+  bool bswap;
+  uint dreq;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint channel);
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c,
+                                           enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_bswap(dma_channel_config *c, bool bswap);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint transfer_count, bool trigger);
+void dma_channel_transfer_from_buffer_now(uint channel,
+                                          const volatile void *read_addr,
+                                          uint32_t transfer_count);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
+
+#endif
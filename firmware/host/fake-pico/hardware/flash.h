@@ -0,0 +1,20 @@
+#ifndef _HARDWARE_FLASH_H
+#define _HARDWARE_FLASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+// Flash is a host array, starting out erased; it is kept for the whole run
+// of the simulation, like flash survives resets.
+const uint8_t *sim_flash_memory();
+#define XIP_BASE (reinterpret_cast<uintptr_t>(sim_flash_memory()))
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data,
+                         size_t count);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _HARDWARE_GPIO_H
+#define _HARDWARE_GPIO_H
+
+#include "pico/types.h"
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+enum gpio_function {
+  GPIO_FUNC_SPI = 1,
+  GPIO_FUNC_UART = 2,
+  GPIO_FUNC_PIO0 = 6,
+  GPIO_FUNC_PIO1 = 7,
+  GPIO_FUNC_SIO = 5,
+  GPIO_FUNC_NULL = 0x1f,
+};
+
+enum gpio_irq_level {
+  GPIO_IRQ_LEVEL_LOW = 0x1u,
+  GPIO_IRQ_LEVEL_HIGH = 0x2u,
+  GPIO_IRQ_EDGE_FALL = 0x4u,
+  GPIO_IRQ_EDGE_RISE = 0x8u,
+};
+
+// Only edge interrupts are simulated.
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask,
+                                        bool enabled,
+                                        gpio_irq_callback_t callback);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+void gpio_pull_up(uint gpio);
+bool gpio_get(uint gpio);
+void gpio_put(uint gpio, bool value);
+
+#endif
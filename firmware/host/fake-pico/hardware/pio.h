@@ -0,0 +1,71 @@
+#ifndef _HARDWARE_PIO_H
+#define _HARDWARE_PIO_H
+
+#include "hardware/pio_instructions.h"
+#include "pico/types.h"
+
+// PIO state machines run the instructions in pio_instructions.h. Words DMA
+// writes to a TX FIFO are run through the program right away, with the
+// timing of the clock divider; the bits put out on the pins go to the
+// simulated board once the program raises its interrupt flag.
+
+typedef volatile uint32_t io_wo_32;
+
+typedef struct {
+  io_wo_32 txf[4];  // Only registers the firmware writes to (by DMA).
+} pio_hw_t;
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio_instance[2];
+#define pio0 (&sim_pio_instance[0])
+#define pio1 (&sim_pio_instance[1])
+
+typedef struct {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;  // -1 for anywhere.
+} pio_program_t;
+
+typedef struct {
+  float clkdiv;
+  uint wrap_target, wrap;
+  uint out_base, out_count;
+  uint sideset_base, sideset_bit_count;
+  bool out_shift_right, autopull;
+  uint pull_threshold;
+} pio_sm_config;
+
+enum pio_fifo_join { PIO_FIFO_JOIN_NONE = 0, PIO_FIFO_JOIN_TX = 1 };
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_gpio_init(PIO pio, uint pin);
+
+pio_sm_config pio_get_default_sm_config();
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional,
+                           bool pindirs);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right,
+                             bool autopull, uint pull_threshold);
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+
+void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin_base,
+                                    uint pin_count, bool is_out);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc,
+                 const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num);
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num);
+
+inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+  return (pio == pio1 ? 8 : 0) + (is_tx ? 0 : 4) + sm;
+}
+
+#endif
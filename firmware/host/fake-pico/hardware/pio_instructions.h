@@ -0,0 +1,32 @@
+#ifndef _HARDWARE_PIO_INSTRUCTIONS_H
+#define _HARDWARE_PIO_INSTRUCTIONS_H
+
+#include "pico/types.h"
+
+// Encoding of the PIO instructions the firmware uses, as in the pico-sdk:
+// opcode in bits 15..13, delay/side-set in 12..8, arguments below.
+
+enum pio_src_dest {
+  pio_pins = 0u,
+  pio_x = 1u,
+  pio_y = 2u,
+};
+
+inline uint pio_encode_sideset(uint sideset_bit_count, uint value) {
+  return value << (13 - sideset_bit_count);
+}
+inline uint pio_encode_jmp_x_dec(uint addr) { return 0x0000 | 2 << 5 | addr; }
+inline uint pio_encode_out(enum pio_src_dest dest, uint count) {
+  return 0x6000 | dest << 5 | (count & 31);
+}
+inline uint pio_encode_pull(bool if_empty, bool block) {
+  return 0x8080 | if_empty << 6 | block << 5;
+}
+inline uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) {
+  return 0xa000 | dest << 5 | src;
+}
+inline uint pio_encode_irq_set(bool relative, uint irq) {
+  return 0xc000 | relative << 4 | irq;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _HARDWARE_RTC_H
+#define _HARDWARE_RTC_H
+
+#include "pico/types.h"
+
+void rtc_init();
+bool rtc_set_datetime(const datetime_t *t);
+bool rtc_get_datetime(datetime_t *t);
+
+#endif
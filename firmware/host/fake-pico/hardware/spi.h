@@ -0,0 +1,39 @@
+#ifndef _HARDWARE_SPI_H
+#define _HARDWARE_SPI_H
+
+#include "pico/types.h"
+
+typedef enum { SPI_CPHA_0 = 0, SPI_CPHA_1 = 1 } spi_cpha_t;
+typedef enum { SPI_CPOL_0 = 0, SPI_CPOL_1 = 1 } spi_cpol_t;
+typedef enum { SPI_LSB_FIRST = 0, SPI_MSB_FIRST = 1 } spi_order_t;
+
+typedef volatile uint32_t io_rw_32;
+
+typedef struct {
+  io_rw_32 dr;  // Only register the firmware writes to (by DMA).
+} spi_hw_t;
+
+typedef struct spi_inst {
+  uint baudrate;
+  uint data_bits;
+  spi_hw_t hw;
+  uint64_t busy_until_ns;  // Virtual time the last bit is shifted out.
+} spi_inst_t;
+
+extern spi_inst_t sim_spi_instance[2];
+#define spi0 (&sim_spi_instance[0])
+#define spi1 (&sim_spi_instance[1])
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol,
+                    spi_cpha_t cpha, spi_order_t order);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+bool spi_is_busy(const spi_inst_t *spi);
+
+inline spi_hw_t *spi_get_hw(spi_inst_t *spi) { return &spi->hw; }
+inline uint spi_get_dreq(spi_inst_t *spi, bool is_tx) {
+  return 2 * (spi == spi1) + (is_tx ? 0 : 1);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _HARDWARE_SYNC_H
+#define _HARDWARE_SYNC_H
+
+#include "pico/types.h"
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+// Spin locks between the cores. Interrupts are disabled while core0 holds
+// one.
+typedef volatile uint32_t spin_lock_t;
+int spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_instance(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _PICO_MULTICORE_H
+#define _PICO_MULTICORE_H
+
+#include "pico/types.h"
+
+// Core1 runs in a host thread. Its HAL calls don't advance the virtual
+// clock: rendering on core1 is assumed to be fast compared to the pull.
+// Before core0 waits for an interrupt, core1 gets to finish its work, until
+// it goes to sleep.
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1();
+
+bool multicore_fifo_rvalid();
+bool multicore_fifo_wready();
+void multicore_fifo_push_blocking(uint32_t data);
+uint32_t multicore_fifo_pop_blocking();
+
+// No need to stop core1 while writing the simulated flash. As on the rp2040,
+// words in the FIFOs are lost once core1 is set up as victim and core0
+// starts a lockout.
+void multicore_lockout_victim_init();
+void multicore_lockout_start_blocking();
+void multicore_lockout_end_blocking();
+
+#endif
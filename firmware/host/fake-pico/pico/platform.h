@@ -0,0 +1,9 @@
+#ifndef _PICO_PLATFORM_H
+#define _PICO_PLATFORM_H
+
+#include "pico/types.h"
+
+// 0 on the main thread, 1 on the thread running core1.
+uint get_core_num();
+
+#endif
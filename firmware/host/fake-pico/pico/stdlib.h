@@ -0,0 +1,20 @@
+#ifndef _PICO_STDLIB_H
+#define _PICO_STDLIB_H
+
+#include <cstdio>
+
+#include "hardware/gpio.h"
+#include "pico/time.h"
+#include "pico/types.h"
+
+#define PICO_ERROR_TIMEOUT (-1)
+
+bool stdio_init_all();
+int getchar_timeout_us(uint32_t timeout_us);
+int putchar_raw(int c);
+void stdio_flush();
+
+// Serial input is only polled in the simulation; the callback is not called.
+void stdio_set_chars_available_callback(void (*fn)(void *), void *param);
+
+#endif
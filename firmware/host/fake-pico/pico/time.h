@@ -0,0 +1,38 @@
+#ifndef _PICO_TIME_H
+#define _PICO_TIME_H
+
+#include "pico/types.h"
+
+absolute_time_t get_absolute_time();
+
+inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+
+inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+  return static_cast<int64_t>(to - from);
+}
+
+inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) {
+  return t + us;
+}
+
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+
+// Virtual time moves on to the next interrupt, which is run, or to the
+// timeout. Returns true if it timed out.
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+// Alarms fire as simulated interrupts, see sim::ScheduleInterrupt()
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void *user_data, bool fire_if_past);
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past);
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past);
+bool cancel_alarm(alarm_id_t alarm_id);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _PICO_TYPES_H
+#define _PICO_TYPES_H
+
+#include <cstddef>
+#include <cstdint>
+
+typedef unsigned int uint;
+
+// Microseconds since boot.
+typedef uint64_t absolute_time_t;
+
+typedef struct {
+  int16_t year;
+  int8_t month;
+  int8_t day;
+  int8_t dotw;  // 0 is Sunday
+  int8_t hour;
+  int8_t min;
+  int8_t sec;
+} datetime_t;
+
+#endif
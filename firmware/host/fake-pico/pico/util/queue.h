@@ -0,0 +1,20 @@
+#ifndef _PICO_UTIL_QUEUE_H
+#define _PICO_UTIL_QUEUE_H
+
+#include "pico/types.h"
+
+// Queue between the cores, held on the host side. Has to be zero
+// initialized, e.g. static, before queue_init(); init again to empty it.
+typedef struct {
+  void *impl;
+  uint element_size;
+  uint element_count;
+} queue_t;
+
+void queue_init(queue_t *q, uint element_size, uint element_count);
+bool queue_is_empty(queue_t *q);
+bool queue_try_add(queue_t *q, const void *data);
+bool queue_try_remove(queue_t *q, void *data);
+void queue_add_blocking(queue_t *q, const void *data);
+
+#endif
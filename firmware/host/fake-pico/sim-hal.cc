@@ -0,0 +1,994 @@
+#include "sim-hal.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/rtc.h"
+#include "hardware/spi.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#include "pico/platform.h"
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "pico/util/queue.h"
+
+namespace sim {
+namespace {
+using HostClock = std::chrono::steady_clock;
+
+Board *s_board = nullptr;
+CallCost s_cost;
+std::atomic<uint64_t> s_now_ns{0};  // Also read from core1
+uint64_t s_end_ns = 0;
+HostClock::time_point s_last_hal_exit;
+
+// Pending interrupts by time; id to tell them apart and cancel.
+std::multimap<uint64_t, std::pair<int, InterruptHandler>> s_interrupts;
+int s_next_interrupt_id = 1;
+bool s_interrupts_enabled = true;
+bool s_in_interrupt = false;
+
+// GPIO interrupts enabled per pin.
+constexpr int kGpioCount = 30;
+struct GpioInterrupt {
+  uint32_t event_mask;
+  int pending_id;  // Interrupt scheduled for next matching edge.
+};
+GpioInterrupt s_gpio_irq[kGpioCount];
+gpio_irq_callback_t s_gpio_callback = nullptr;
+
+// Alarm ids stay the same when re-scheduled, the interrupt ids don't.
+std::map<alarm_id_t, int> s_alarm_interrupt;
+
+// Core1 thread and the inter-core FIFOs.
+thread_local bool t_on_core1 = false;
+std::thread s_core1;
+std::atomic<bool> s_core1_stop{false};
+// Core1 going to sleep, i.e. done with what it had to do, counted; core0
+// waking it up to look again.
+std::mutex s_core1_idle_mutex;
+std::condition_variable s_core1_idle_cv;
+uint64_t s_core1_idle_count = 0;
+uint64_t s_core1_wakeups = 0;
+struct Fifo {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<uint32_t> data;
+};
+Fifo s_fifo[2];  // Index: receiving core.
+// Core1 set up to be paused for flash writes. Like the SDK's handler for the
+// FIFO interrupt, it then throws away what is in the FIFOs at each pause.
+bool s_lockout_victim = false;
+
+// Host side of a queue_t.
+struct Queue {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::vector<uint8_t>> data;
+};
+
+// Spin locks, taken in turn: firmware runs claim them without giving back.
+constexpr int kSpinLockCount = 32;
+spin_lock_t s_spin_locks[kSpinLockCount];
+std::mutex s_spin_mutex[kSpinLockCount];
+int s_spin_claimed = 0;
+
+void StopCore1() {
+  if (!s_core1.joinable()) return;
+  s_core1_stop = true;
+  for (Fifo &fifo : s_fifo) fifo.cv.notify_all();
+  s_core1_idle_cv.notify_all();
+  s_core1.join();
+  s_core1_stop = false;
+  for (Fifo &fifo : s_fifo) fifo.data.clear();
+  s_lockout_victim = false;
+}
+
+struct StopCore1AtExit {
+  ~StopCore1AtExit() { StopCore1(); }
+} s_stop_core1_at_exit;
+
+// Wall-clock time of the rtc at virtual time zero.
+datetime_t s_rtc_base{};
+bool s_rtc_valid = false;
+
+constexpr int kDmaChannels = 12;
+constexpr size_t kSpiFifoDepth = 8;
+struct DmaChannel {
+  bool claimed;
+  dma_channel_config config;
+  volatile void *write_addr;
+  uint64_t busy_until_ns;
+};
+DmaChannel s_dma[kDmaChannels];
+
+constexpr uint32_t kSysClockHz = 125'000'000;
+std::atomic<uint32_t> s_sys_clock_hz{kSysClockHz};  // Also read from core1
+uint64_t s_asleep_ns = 0;
+bool s_wake_event = false;  // An interrupt ran since the last wait for one.
+std::vector<uint64_t> s_clock_raises;
+constexpr size_t kPioFifoDepth = 8;  // TX FIFO joined.
+struct PioStateMachine {
+  bool claimed;
+  bool enabled;
+  pio_sm_config config;
+  uint pc;
+  uint32_t x, y, osr;
+  uint osr_count;  // Bits shifted out of the OSR; at the threshold: empty.
+  std::deque<uint32_t> fifo;
+  uint64_t stalled_ns;  // Waiting for data again from then on.
+  std::vector<uint8_t> out;  // Bits put out on the pins since last flag.
+  uint out_bits;
+  uint64_t out_start_ns;
+};
+struct PioBlock {
+  uint16_t instructions[32];
+  uint used;
+  PioStateMachine sm[4];
+  bool irq[8];
+  uint64_t irq_ns[8];  // Time the flag is raised.
+};
+PioBlock s_pio[2];
+}  // namespace
+
+void Install(Board *board, const CallCost &cost, uint64_t end_ns) {
+  StopCore1();
+  s_board = board;
+  s_cost = cost;
+  s_now_ns = 0;
+  s_end_ns = end_ns;
+  s_rtc_valid = false;
+  s_sys_clock_hz = kSysClockHz;
+  s_asleep_ns = 0;
+  s_wake_event = false;
+  s_clock_raises.clear();
+  for (spi_inst_t &spi : sim_spi_instance) spi.busy_until_ns = 0;
+  for (DmaChannel &dma : s_dma) dma = {};
+  for (PioBlock &pio : s_pio) pio = {};
+  s_interrupts.clear();
+  s_interrupts_enabled = true;
+  s_in_interrupt = false;
+  s_alarm_interrupt.clear();
+  for (GpioInterrupt &irq : s_gpio_irq) irq = {};
+  s_gpio_callback = nullptr;
+  s_last_hal_exit = HostClock::now();
+}
+
+uint64_t NowNanos() { return s_now_ns; }
+Board *board() { return s_board; }
+uint64_t AsleepNanos() { return s_asleep_ns; }
+const std::vector<uint64_t> &ClockRaises() { return s_clock_raises; }
+
+CallCost cost() {
+  CallCost scaled = s_cost;
+  const uint32_t hz = s_sys_clock_hz;
+  if (hz == kSysClockHz) return scaled;
+  for (uint32_t *ns : {&scaled.gpio_ns, &scaled.irq_entry_ns,
+                       &scaled.time_read_ns, &scaled.getchar_ns,
+                       &scaled.spi_setup_ns}) {
+    *ns = uint64_t(*ns) * kSysClockHz / hz;
+  }
+  scaled.cpu_scale *= double(kSysClockHz) / hz;
+  return scaled;
+}
+
+void Charge(uint64_t ns) {
+  if (t_on_core1) {
+    if (s_core1_stop) throw EndOfSimulation();
+    return;
+  }
+  const double cpu_scale = cost().cpu_scale;
+  if (cpu_scale > 0) {
+    const auto compute = HostClock::now() - s_last_hal_exit;
+    ns += std::chrono::duration_cast<std::chrono::nanoseconds>(compute).count() *
+          cpu_scale;
+  }
+  // Interrupts that became due while the code ran steal time from it.
+  while (s_interrupts_enabled && !s_in_interrupt && !s_interrupts.empty()) {
+    auto next = s_interrupts.begin();
+    if (next->first > s_now_ns + ns) break;
+    const uint64_t at = std::max<uint64_t>(next->first, s_now_ns);
+    ns -= at - s_now_ns;
+    s_now_ns = at;
+    InterruptHandler handler = std::move(next->second.second);
+    s_interrupts.erase(next);
+    s_in_interrupt = true;
+    handler();
+    s_in_interrupt = false;
+    s_wake_event = true;
+  }
+  s_now_ns += ns;
+  if (s_now_ns >= s_end_ns) throw EndOfSimulation();
+  s_last_hal_exit = HostClock::now();
+}
+
+int ScheduleInterrupt(uint64_t at_ns, InterruptHandler handler) {
+  const int id = s_next_interrupt_id++;
+  s_interrupts.insert({at_ns, {id, std::move(handler)}});
+  return id;
+}
+
+bool CancelInterrupt(int id) {
+  for (auto it = s_interrupts.begin(); it != s_interrupts.end(); ++it) {
+    if (it->second.first == id) {
+      s_interrupts.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DisableInterrupts() {
+  const bool was_enabled = s_interrupts_enabled;
+  s_interrupts_enabled = false;
+  return was_enabled;
+}
+
+void EnableInterrupts() { s_interrupts_enabled = true; }
+}  // namespace sim
+
+// -- pico/time.h
+absolute_time_t get_absolute_time() {
+  sim::Charge(sim::cost().time_read_ns);
+  return sim::NowNanos() / 1000;
+}
+
+void sleep_us(uint64_t us) {
+  if (sim::t_on_core1) {  // Don't spin too hard.
+    std::unique_lock<std::mutex> l(sim::s_core1_idle_mutex);
+    ++sim::s_core1_idle_count;
+    sim::s_core1_idle_cv.notify_all();
+    const uint64_t wakeups = sim::s_core1_wakeups;
+    sim::s_core1_idle_cv.wait_for(l, std::chrono::microseconds(500), [=]() {
+      return sim::s_core1_wakeups != wakeups || sim::s_core1_stop;
+    });
+  }
+  sim::Charge(us * 1000);
+}
+void sleep_ms(uint32_t ms) { sleep_us(uint64_t(ms) * 1000); }
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp) {
+  sim::Charge(0);  // Run what is due already.
+  // Like the event register, an interrupt that came before the wait ends it.
+  if (sim::s_wake_event) {
+    sim::s_wake_event = false;
+    return false;
+  }
+  // Rendering on core1 takes no virtual time: let it catch up first.
+  if (sim::s_core1.joinable()) {
+    std::unique_lock<std::mutex> l(sim::s_core1_idle_mutex);
+    ++sim::s_core1_wakeups;
+    sim::s_core1_idle_cv.notify_all();
+    const uint64_t seen = sim::s_core1_idle_count;
+    sim::s_core1_idle_cv.wait(l, [seen]() {
+      return sim::s_core1_idle_count > seen;
+    });
+  }
+  const uint64_t now = sim::NowNanos();
+  uint64_t wake = timeout_timestamp * 1000;
+  if (sim::s_interrupts_enabled && !sim::s_interrupts.empty()) {
+    wake = std::min(wake, sim::s_interrupts.begin()->first);
+  }
+  if (wake > now) {
+    sim::s_asleep_ns += wake - now;
+    sim::Charge(wake - now);  // Runs the interrupt due then.
+  }
+  sim::s_wake_event = false;
+  return sim::NowNanos() >= timeout_timestamp * 1000;
+}
+
+namespace sim {
+namespace {
+void ScheduleAlarm(alarm_id_t id, uint64_t at_us, alarm_callback_t callback,
+                   void *user_data) {
+  s_alarm_interrupt[id] =
+      ScheduleInterrupt(at_us * 1000, [=]() {
+        s_alarm_interrupt.erase(id);
+        const int64_t reschedule = callback(id, user_data);
+        if (reschedule > 0) {
+          ScheduleAlarm(id, at_us + reschedule, callback, user_data);
+        } else if (reschedule < 0) {
+          ScheduleAlarm(id, NowNanos() / 1000 - reschedule, callback,
+                        user_data);
+        }
+      });
+}
+}  // namespace
+}  // namespace sim
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback,
+                        void *user_data, bool fire_if_past) {
+  static alarm_id_t next_id = 1;
+  if (time <= sim::NowNanos() / 1000) {
+    if (!fire_if_past) return 0;
+    // Called right away; only creates an alarm if it wants to be repeated.
+    const int64_t reschedule = callback(0, user_data);
+    if (reschedule == 0) return 0;
+    time = sim::NowNanos() / 1000 + (reschedule < 0 ? -reschedule : reschedule);
+  }
+  const alarm_id_t id = next_id++;
+  sim::ScheduleAlarm(id, time, callback, user_data);
+  return id;
+}
+
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past) {
+  return add_alarm_at(sim::NowNanos() / 1000 + us, callback, user_data,
+                      fire_if_past);
+}
+
+alarm_id_t add_alarm_in_ms(uint32_t ms, alarm_callback_t callback,
+                           void *user_data, bool fire_if_past) {
+  return add_alarm_in_us(uint64_t(ms) * 1000, callback, user_data,
+                         fire_if_past);
+}
+
+bool cancel_alarm(alarm_id_t alarm_id) {
+  auto found = sim::s_alarm_interrupt.find(alarm_id);
+  if (found == sim::s_alarm_interrupt.end()) return false;
+  sim::CancelInterrupt(found->second);
+  sim::s_alarm_interrupt.erase(found);
+  return true;
+}
+
+// -- hardware/sync.h
+uint32_t save_and_disable_interrupts() { return sim::DisableInterrupts(); }
+
+void restore_interrupts(uint32_t status) {
+  if (status) sim::EnableInterrupts();
+}
+
+int spin_lock_claim_unused(bool) {
+  return sim::s_spin_claimed++ % sim::kSpinLockCount;
+}
+
+spin_lock_t *spin_lock_instance(uint lock_num) {
+  return &sim::s_spin_locks[lock_num];
+}
+
+uint32_t spin_lock_blocking(spin_lock_t *lock) {
+  const uint32_t irq_state = sim::t_on_core1 ? 0 : sim::DisableInterrupts();
+  sim::s_spin_mutex[lock - sim::s_spin_locks].lock();
+  return irq_state;
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq) {
+  sim::s_spin_mutex[lock - sim::s_spin_locks].unlock();
+  if (saved_irq) sim::EnableInterrupts();
+}
+
+// -- hardware/gpio.h
+void gpio_init(uint) { sim::Charge(sim::cost().gpio_ns); }
+void gpio_set_dir(uint, bool) { sim::Charge(sim::cost().gpio_ns); }
+void gpio_set_function(uint, enum gpio_function) {
+  sim::Charge(sim::cost().gpio_ns);
+}
+void gpio_pull_up(uint) { sim::Charge(sim::cost().gpio_ns); }
+
+bool gpio_get(uint gpio) {
+  sim::Charge(sim::cost().gpio_ns);
+  return sim::board()->ReadPin(gpio, sim::NowNanos());
+}
+
+void gpio_put(uint gpio, bool value) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::board()->WritePin(gpio, value, sim::NowNanos());
+}
+
+namespace sim {
+namespace {
+// Schedule interrupt for the next edge after "after_ns" matching the mask.
+// Like the hardware, edges happening while the interrupt is pending are
+// not counted again.
+void ArmGpioInterrupt(uint gpio, uint64_t after_ns) {
+  GpioInterrupt &irq = s_gpio_irq[gpio];
+  uint64_t t = after_ns;
+  while ((t = board()->NextPinChange(gpio, t)) != UINT64_MAX) {
+    const uint32_t event = board()->ReadPin(gpio, t) ? GPIO_IRQ_EDGE_RISE
+                                                     : GPIO_IRQ_EDGE_FALL;
+    if ((irq.event_mask & event) == 0) continue;
+    irq.pending_id = ScheduleInterrupt(t, [gpio, event]() {
+      s_gpio_irq[gpio].pending_id = 0;
+      Charge(cost().irq_entry_ns);
+      if (s_gpio_callback) s_gpio_callback(gpio, event);
+      ArmGpioInterrupt(gpio, NowNanos());
+    });
+    return;
+  }
+}
+}  // namespace
+}  // namespace sim
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled) {
+  sim::GpioInterrupt &irq = sim::s_gpio_irq[gpio];
+  if (irq.pending_id) sim::CancelInterrupt(irq.pending_id);
+  irq = {};
+  if (enabled) {
+    irq.event_mask = event_mask;
+    sim::ArmGpioInterrupt(gpio, sim::NowNanos());
+  }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask,
+                                        bool enabled,
+                                        gpio_irq_callback_t callback) {
+  sim::s_gpio_callback = callback;
+  gpio_set_irq_enabled(gpio, event_mask, enabled);
+}
+
+// -- hardware/spi.h
+spi_inst_t sim_spi_instance[2];
+
+uint spi_init(spi_inst_t *spi, uint baudrate) {
+  spi->baudrate = baudrate;
+  return baudrate;
+}
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate) {
+  spi->baudrate = baudrate;
+  return baudrate;
+}
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t, spi_cpha_t,
+                    spi_order_t) {
+  spi->data_bits = data_bits;
+}
+
+// Start shifting out bytes in the background; returns time last bit is out.
+static uint64_t SpiShiftOut(spi_inst_t *spi, const uint8_t *src, size_t len) {
+  const uint64_t start = std::max(sim::NowNanos(), spi->busy_until_ns);
+  const uint64_t bit_ns = 1'000'000'000 / spi->baudrate;
+  spi->busy_until_ns = start + len * spi->data_bits * bit_ns;
+  sim::board()->SpiWrite(src, len, start, spi->busy_until_ns);
+  return spi->busy_until_ns;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len) {
+  sim::Charge(sim::cost().spi_setup_ns);
+  const uint64_t done = SpiShiftOut(spi, src, len);
+  sim::Charge(done - sim::NowNanos());
+  return len;
+}
+
+bool spi_is_busy(const spi_inst_t *spi) {
+  sim::Charge(sim::cost().gpio_ns);
+  return sim::NowNanos() < spi->busy_until_ns;
+}
+
+// -- hardware/clocks.h
+uint32_t clock_get_hz(enum clock_index) { return sim::s_sys_clock_hz; }
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool) {
+  sim::Charge(sim::cost().clock_switch_ns);
+  sim::s_sys_clock_hz = freq_khz * 1000;
+  if (sim::s_sys_clock_hz == sim::kSysClockHz) {
+    sim::s_clock_raises.push_back(sim::NowNanos());
+  }
+  return true;
+}
+
+// From the running USB PLL: no relock.
+void set_sys_clock_48mhz() {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::s_sys_clock_hz = 48'000'000;
+}
+
+// -- hardware/pio.h
+pio_hw_t sim_pio_instance[2];
+
+namespace sim {
+namespace {
+PioBlock &Block(PIO pio) { return s_pio[pio - sim_pio_instance]; }
+
+// Execute one instruction at time t_ns; returns false if it stalls.
+bool PioExecute(PioBlock &block, uint index, uint16_t instr, uint64_t t_ns) {
+  PioStateMachine &sm = block.sm[index];
+  const pio_sm_config &c = sm.config;
+  const uint opcode = instr >> 13;
+  const uint dest = (instr >> 5) & 7;
+  const uint arg = instr & 31;
+  uint next_pc = (sm.pc == c.wrap) ? c.wrap_target : sm.pc + 1;
+  switch (opcode) {
+  case 0: {  // JMP
+    bool jump = true;
+    if (dest == 1) jump = (sm.x == 0);
+    if (dest == 2) jump = (sm.x-- != 0);
+    if (dest > 2) abort();  // Not simulated.
+    if (jump) next_pc = arg;
+    break;
+  }
+  case 3: {  // OUT
+    if (sm.osr_count >= c.pull_threshold && c.autopull) {
+      if (sm.fifo.empty()) return false;
+      sm.osr = sm.fifo.front();
+      sm.fifo.pop_front();
+      sm.osr_count = 0;
+    }
+    const uint bits = arg ? arg : 32;
+    if (c.out_shift_right) abort();  // Not simulated.
+    const uint32_t value = bits == 32 ? sm.osr : sm.osr >> (32 - bits);
+    sm.osr = bits == 32 ? 0 : sm.osr << bits;
+    sm.osr_count += bits;
+    if (dest == 1) sm.x = value;
+    if (dest == 2) sm.y = value;
+    if (dest == 0) {  // Pins, most significant bit first.
+      if (sm.out_bits == 0) sm.out_start_ns = t_ns;
+      for (int b = bits - 1; b >= 0; --b, ++sm.out_bits) {
+        if (sm.out_bits % 8 == 0) sm.out.push_back(0);
+        if ((value >> b) & 1) sm.out.back() |= 0x80 >> (sm.out_bits % 8);
+      }
+    }
+    if (dest > 2) abort();
+    break;
+  }
+  case 4: {  // PULL
+    if (!(instr & 0x80)) abort();  // PUSH not simulated.
+    const bool if_empty = instr & 0x40;
+    const bool block_on_empty = instr & 0x20;
+    if (if_empty && sm.osr_count < c.pull_threshold) break;
+    if (sm.fifo.empty()) {
+      if (block_on_empty) return false;
+      sm.osr = sm.x;
+    } else {
+      sm.osr = sm.fifo.front();
+      sm.fifo.pop_front();
+    }
+    sm.osr_count = 0;
+    break;
+  }
+  case 5: {  // MOV, plain copy between x and y.
+    const uint src = instr & 7;
+    const uint32_t value = src == 1 ? sm.x : src == 2 ? sm.y : 0;
+    if ((instr & 0x18) || src == 0 || src > 2) abort();
+    if (dest == 1) sm.x = value;
+    if (dest == 2) sm.y = value;
+    if (dest == 0 || dest > 2) abort();
+    break;
+  }
+  case 6: {  // IRQ set; the bits put out so far went to the board.
+    if (instr & 0x60) abort();  // Clear and wait not simulated.
+    const uint flag = (arg & 0x10) ? (arg & 4) | ((arg + index) & 3) : arg & 7;
+    block.irq[flag] = true;
+    block.irq_ns[flag] = t_ns;
+    if (sm.out_bits > 0) {
+      board()->SpiWrite(sm.out.data(), sm.out.size(), sm.out_start_ns, t_ns);
+    }
+    sm.out.clear();
+    sm.out_bits = 0;
+    break;
+  }
+  default:
+    abort();  // Not simulated.
+  }
+  sm.pc = next_pc;
+  return true;
+}
+
+// Run the state machine until it waits for data. Returns the time when the
+// word at FIFO position "pulled" is taken (the start if it's not there).
+uint64_t PioRun(PioBlock &block, uint index, size_t pulled) {
+  PioStateMachine &sm = block.sm[index];
+  const uint64_t start_ns = std::max(NowNanos(), sm.stalled_ns);
+  const double cycle_ns = 1e9 / s_sys_clock_hz * sm.config.clkdiv;
+  uint64_t pulled_ns = start_ns;
+  const size_t words = sm.fifo.size();
+  for (uint64_t cycle = 0; /**/; ++cycle) {
+    const uint64_t t_ns = start_ns + cycle * cycle_ns;
+    if (pulled > 0 && words - sm.fifo.size() == pulled) {
+      pulled_ns = t_ns;
+      pulled = 0;
+    }
+    if (!PioExecute(block, index, block.instructions[sm.pc], t_ns)) {
+      sm.stalled_ns = t_ns;
+      return pulled_ns;
+    }
+  }
+}
+
+// Words by DMA; returns when DMA is done putting them into the FIFO.
+uint64_t PioWrite(PIO pio, uint index, const std::vector<uint32_t> &words) {
+  PioBlock &block = Block(pio);
+  PioStateMachine &sm = block.sm[index];
+  sm.fifo.insert(sm.fifo.end(), words.begin(), words.end());
+  if (!sm.enabled) return NowNanos();
+  const size_t waiting = words.size() > kPioFifoDepth
+                             ? words.size() - kPioFifoDepth : 0;
+  return PioRun(block, index, waiting);
+}
+}  // namespace
+}  // namespace sim
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+  sim::PioBlock &block = sim::Block(pio);
+  const uint offset = block.used;
+  if (program->origin >= 0 || offset + program->length > 32) abort();
+  for (uint i = 0; i < program->length; ++i) {
+    uint16_t instr = program->instructions[i];
+    if ((instr >> 13) == 0) instr += offset;  // Relocate JMP.
+    block.instructions[offset + i] = instr;
+  }
+  block.used += program->length;
+  return offset;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+  for (int i = 0; i < 4; ++i) {
+    sim::PioStateMachine &sm = sim::Block(pio).sm[i];
+    if (!sm.claimed) {
+      sm = {};
+      sm.claimed = true;
+      return i;
+    }
+  }
+  if (required) abort();
+  return -1;
+}
+
+void pio_gpio_init(PIO, uint pin) { gpio_set_function(pin, GPIO_FUNC_PIO0); }
+
+pio_sm_config pio_get_default_sm_config() {
+  pio_sm_config c = {};
+  c.clkdiv = 1;
+  c.wrap = 31;
+  c.pull_threshold = 32;
+  c.out_shift_right = true;
+  return c;
+}
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {
+  c->wrap_target = wrap_target;
+  c->wrap = wrap;
+}
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) {
+  c->out_base = out_base;
+  c->out_count = out_count;
+}
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool, bool) {
+  c->sideset_bit_count = bit_count;
+}
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) {
+  c->sideset_base = sideset_base;
+}
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right,
+                             bool autopull, uint pull_threshold) {
+  c->out_shift_right = shift_right;
+  c->autopull = autopull;
+  c->pull_threshold = pull_threshold ? pull_threshold : 32;
+}
+void sm_config_set_fifo_join(pio_sm_config *, enum pio_fifo_join) {}
+void sm_config_set_clkdiv(pio_sm_config *c, float div) { c->clkdiv = div; }
+
+void pio_sm_set_consecutive_pindirs(PIO, uint, uint, uint, bool) {
+  sim::Charge(sim::cost().gpio_ns);
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc,
+                 const pio_sm_config *config) {
+  sim::PioStateMachine &state = sim::Block(pio).sm[sm];
+  state.enabled = false;
+  state.config = *config;
+  state.pc = initial_pc;
+  state.osr_count = config->pull_threshold;  // Empty.
+  state.fifo.clear();
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+  sim::Block(pio).sm[sm].enabled = enabled;
+  if (enabled) sim::PioWrite(pio, sm, {});
+}
+
+void pio_sm_set_clkdiv(PIO pio, uint sm, float div) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::Block(pio).sm[sm].config.clkdiv = div;
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::PioWrite(pio, sm, {data});
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::PioStateMachine &state = sim::Block(pio).sm[sm];
+  const uint pc = state.pc;
+  if (!sim::PioExecute(sim::Block(pio), sm, instr, sim::NowNanos())) abort();
+  if ((instr >> 13) != 0) state.pc = pc;  // Only a JMP changes it.
+}
+
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num) {
+  sim::Charge(sim::cost().gpio_ns);
+  const sim::PioBlock &block = sim::Block(pio);
+  return block.irq[pio_interrupt_num] &&
+         sim::NowNanos() >= block.irq_ns[pio_interrupt_num];
+}
+
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::PioBlock &block = sim::Block(pio);
+  if (sim::NowNanos() >= block.irq_ns[pio_interrupt_num]) {
+    block.irq[pio_interrupt_num] = false;
+  }
+}
+
+// -- hardware/dma.h
+int dma_claim_unused_channel(bool required) {
+  for (int i = 0; i < sim::kDmaChannels; ++i) {
+    if (!sim::s_dma[i].claimed) {
+      sim::s_dma[i] = {};
+      sim::s_dma[i].claimed = true;
+      return i;
+    }
+  }
+  if (required) abort();
+  return -1;
+}
+
+void dma_channel_unclaim(uint channel) {
+  sim::s_dma[channel].claimed = false;
+}
+
+dma_channel_config dma_channel_get_default_config(uint) {
+  return {DMA_SIZE_32, true, false, false, 0x3f};
+}
+void channel_config_set_transfer_data_size(
+    dma_channel_config *c, enum dma_channel_transfer_size size) {
+  c->size = size;
+}
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {
+  c->read_increment = incr;
+}
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {
+  c->write_increment = incr;
+}
+void channel_config_set_bswap(dma_channel_config *c, bool bswap) {
+  c->bswap = bswap;
+}
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) {
+  c->dreq = dreq;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config,
+                           volatile void *write_addr,
+                           const volatile void *read_addr,
+                           uint transfer_count, bool trigger) {
+  sim::s_dma[channel].config = *config;
+  sim::s_dma[channel].write_addr = write_addr;
+  if (trigger) {
+    dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+  }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel,
+                                          const volatile void *read_addr,
+                                          uint32_t transfer_count) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::DmaChannel &dma = sim::s_dma[channel];
+  const size_t len = transfer_count << dma.config.size;
+  for (spi_inst_t *spi : {spi0, spi1}) {
+    if (dma.write_addr != &spi->hw.dr) continue;
+    const uint64_t done = SpiShiftOut(spi, (const uint8_t *)read_addr, len);
+    // DMA is done once the last bytes made it into the TX FIFO.
+    const uint64_t byte_ns = 8 * 1'000'000'000ull / spi->baudrate;
+    dma.busy_until_ns = done - std::min(len, sim::kSpiFifoDepth) * byte_ns;
+  }
+  for (int p = 0; p < 2; ++p) {
+    for (uint sm = 0; sm < 4; ++sm) {
+      if (dma.write_addr != &sim_pio_instance[p].txf[sm]) continue;
+      std::vector<uint32_t> words(transfer_count);
+      memcpy(words.data(), (const void *)read_addr, 4 * transfer_count);
+      if (dma.config.bswap) {
+        for (uint32_t &word : words) word = __builtin_bswap32(word);
+      }
+      dma.busy_until_ns = sim::PioWrite(&sim_pio_instance[p], sm, words);
+    }
+  }
+}
+
+bool dma_channel_is_busy(uint channel) {
+  sim::Charge(sim::cost().gpio_ns);
+  return sim::NowNanos() < sim::s_dma[channel].busy_until_ns;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel) {
+  while (dma_channel_is_busy(channel)) {
+  }
+}
+
+// -- pico/stdlib.h
+bool stdio_init_all() { return true; }
+
+int getchar_timeout_us(uint32_t) {
+  sim::Charge(sim::cost().getchar_ns);
+  const int c = sim::board()->ReadChar(sim::NowNanos());
+  return c < 0 ? PICO_ERROR_TIMEOUT : c;
+}
+
+int putchar_raw(int c) {
+  if (sim::board() == nullptr) return putchar(c);
+  sim::board()->WriteChar(c, sim::NowNanos());
+  return c;
+}
+void stdio_flush() { fflush(stdout); }
+void stdio_set_chars_available_callback(void (*)(void *), void *) {}
+
+// -- hardware/rtc.h
+// Only keeps track of seconds within the day, good enough for a simulation
+// that runs for minutes.
+void rtc_init() {}
+
+bool rtc_set_datetime(const datetime_t *t) {
+  sim::s_rtc_base = *t;
+  sim::s_rtc_valid = true;
+  return true;
+}
+
+bool rtc_get_datetime(datetime_t *t) {
+  if (!sim::s_rtc_valid) return false;
+  *t = sim::s_rtc_base;
+  const int64_t sec = sim::NowNanos() / 1'000'000'000 + t->sec +
+                      60 * (t->min + 60 * t->hour);
+  t->sec = sec % 60;
+  t->min = (sec / 60) % 60;
+  t->hour = (sec / 3600) % 24;
+  return true;
+}
+
+// -- pico/platform.h
+uint get_core_num() { return sim::t_on_core1 ? 1 : 0; }
+
+// -- pico/multicore.h
+void multicore_launch_core1(void (*entry)(void)) {
+  sim::StopCore1();
+  sim::s_core1 = std::thread([entry]() {
+    sim::t_on_core1 = true;
+    try {
+      entry();
+    } catch (const sim::EndOfSimulation &) {
+    }
+  });
+}
+
+void multicore_reset_core1() { sim::StopCore1(); }
+
+bool multicore_fifo_rvalid() {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::Fifo &fifo = sim::s_fifo[sim::t_on_core1];
+  std::lock_guard<std::mutex> l(fifo.mutex);
+  return !fifo.data.empty();
+}
+
+bool multicore_fifo_wready() { return true; }
+
+void multicore_fifo_push_blocking(uint32_t data) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::Fifo &fifo = sim::s_fifo[!sim::t_on_core1];
+  std::lock_guard<std::mutex> l(fifo.mutex);
+  fifo.data.push_back(data);
+  fifo.cv.notify_all();
+}
+
+uint32_t multicore_fifo_pop_blocking() {
+  sim::Fifo &fifo = sim::s_fifo[sim::t_on_core1];
+  for (;;) {
+    sim::Charge(sim::cost().gpio_ns);
+    std::unique_lock<std::mutex> l(fifo.mutex);
+    if (sim::t_on_core1) {
+      fifo.cv.wait(l, []() {
+        return !sim::s_fifo[1].data.empty() || sim::s_core1_stop;
+      });
+    }
+    if (!fifo.data.empty()) {
+      const uint32_t result = fifo.data.front();
+      fifo.data.pop_front();
+      return result;
+    }
+  }
+}
+
+// The flash is simulated in memory: core1 keeps running. The lockout
+// handshake runs through the FIFOs though, and takes what is in them.
+void multicore_lockout_victim_init() { sim::s_lockout_victim = true; }
+
+void multicore_lockout_start_blocking() {
+  if (!sim::s_core1.joinable() || !sim::s_lockout_victim) return;
+  for (sim::Fifo &fifo : sim::s_fifo) {
+    std::lock_guard<std::mutex> l(fifo.mutex);
+    fifo.data.clear();
+  }
+}
+
+void multicore_lockout_end_blocking() {}
+
+// -- pico/util/queue.h
+namespace {
+sim::Queue *HostQueue(queue_t *q) {
+  return static_cast<sim::Queue *>(q->impl);
+}
+}  // namespace
+
+void queue_init(queue_t *q, uint element_size, uint element_count) {
+  if (!q->impl) q->impl = new sim::Queue;
+  HostQueue(q)->data.clear();
+  q->element_size = element_size;
+  q->element_count = element_count;
+}
+
+bool queue_is_empty(queue_t *q) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::Queue *queue = HostQueue(q);
+  std::lock_guard<std::mutex> l(queue->mutex);
+  return queue->data.empty();
+}
+
+bool queue_try_add(queue_t *q, const void *data) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::Queue *queue = HostQueue(q);
+  std::lock_guard<std::mutex> l(queue->mutex);
+  if (queue->data.size() >= q->element_count) return false;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  queue->data.emplace_back(bytes, bytes + q->element_size);
+  queue->cv.notify_all();
+  return true;
+}
+
+bool queue_try_remove(queue_t *q, void *data) {
+  sim::Charge(sim::cost().gpio_ns);
+  sim::Queue *queue = HostQueue(q);
+  std::lock_guard<std::mutex> l(queue->mutex);
+  if (queue->data.empty()) return false;
+  memcpy(data, queue->data.front().data(), q->element_size);
+  queue->data.pop_front();
+  queue->cv.notify_all();
+  return true;
+}
+
+void queue_add_blocking(queue_t *q, const void *data) {
+  sim::Queue *queue = HostQueue(q);
+  while (!queue_try_add(q, data)) {
+    std::unique_lock<std::mutex> l(queue->mutex);
+    queue->cv.wait_for(l, std::chrono::microseconds(500), [=]() {
+      return queue->data.size() < q->element_count || sim::s_core1_stop;
+    });
+  }
+}
+
+// -- hardware/flash.h
+namespace {
+uint8_t *FlashMemory() {
+  static uint8_t *const flash = []() {
+    uint8_t *result = new uint8_t[PICO_FLASH_SIZE_BYTES];
+    memset(result, 0xff, PICO_FLASH_SIZE_BYTES);
+    return result;
+  }();
+  return flash;
+}
+}  // namespace
+
+const uint8_t *sim_flash_memory() { return FlashMemory(); }
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+  sim::Charge(sim::cost().flash_erase_ns * (count / FLASH_SECTOR_SIZE));
+  memset(FlashMemory() + flash_offs, 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data,
+                         size_t count) {
+  sim::Charge(sim::cost().flash_program_ns * (count / FLASH_PAGE_SIZE));
+  for (size_t i = 0; i < count; ++i) {
+    FlashMemory()[flash_offs + i] &= data[i];  // Programming only clears bits
+  }
+}
@@ -0,0 +1,94 @@
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+// Stand-in for the bits of the pico-sdk the firmware uses, so that it can be
+// compiled and run on a host. Time is virtual: it only moves forward when the
+// firmware calls into the HAL, each call being charged a configurable cost.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+namespace sim {
+
+// Virtual time cost of HAL calls, roughly what they take on a 125Mhz rp2040.
+// Calls up to spi_setup_ns take longer at a lower system clock.
+struct CallCost {
+  uint32_t gpio_ns = 30;
+  uint32_t irq_entry_ns = 300;  // Interrupt entry and exit.
+  uint32_t time_read_ns = 150;
+  uint32_t getchar_ns = 3'000;  // stdio_usb takes a mutex and polls tinyusb.
+  uint32_t spi_setup_ns = 1'000;
+  uint32_t flash_erase_ns = 45'000'000;  // Per sector.
+  uint32_t flash_program_ns = 400'000;   // Per page.
+  uint32_t clock_switch_ns = 100'000;  // PLL relock; assumed, not measured.
+  double cpu_scale = 0;  // Charge measured host compute time * this factor.
+};
+
+// The world outside the rp2040: what is connected to the pins.
+class Board {
+ public:
+  virtual ~Board() = default;
+
+  virtual bool ReadPin(int gpio, uint64_t now_ns) = 0;
+
+  // Time after "after_ns" the input level on the pin changes next. Only
+  // needed for pins that trigger interrupts.
+  virtual uint64_t NextPinChange(int /*gpio*/, uint64_t /*after_ns*/) {
+    return UINT64_MAX;
+  }
+  virtual void WritePin(int gpio, bool value, uint64_t now_ns) = 0;
+
+  // Bytes shifted out on SPI between start_ns and end_ns. Also the bits a
+  // PIO state machine put out on its pins, in the order it did, up to it
+  // raising its interrupt flag at end_ns.
+  virtual void SpiWrite(const uint8_t *data, size_t len, uint64_t start_ns,
+                        uint64_t end_ns) = 0;
+
+  // Next character for the stdio input or -1 if none available.
+  virtual int ReadChar(uint64_t /*now_ns*/) { return -1; }
+
+  // Character the firmware wrote raw to stdio, e.g. a packet ack. Goes to
+  // stdout unless the board wants to see it.
+  virtual void WriteChar(int c, uint64_t /*now_ns*/) { putchar(c); }
+};
+
+// Thrown out of the HAL once virtual time passed the end of the simulation;
+// that is the only way to leave the firmware main loop.
+struct EndOfSimulation {};
+
+// Reset virtual clock to zero and connect firmware to given board. The
+// simulation ends once the clock reaches "end_ns".
+void Install(Board *board, const CallCost &cost, uint64_t end_ns);
+
+uint64_t NowNanos();
+
+// Advance virtual clock by "ns" plus, if enabled, the scaled host time spent
+// in firmware code since the last HAL call.
+void Charge(uint64_t ns);
+
+Board *board();
+CallCost cost();  // For the current system clock.
+
+// Virtual time core0 spent waiting for interrupts.
+uint64_t AsleepNanos();
+
+// Times the system clock was set back to 125MHz, oldest first.
+const std::vector<uint64_t> &ClockRaises();
+
+// Interrupts are handlers scheduled at a virtual time. They run once the
+// clock passes that time, in between HAL calls of the interrupted code,
+// unless interrupts are disabled. Handlers don't nest.
+using InterruptHandler = std::function<void()>;
+int ScheduleInterrupt(uint64_t at_ns, InterruptHandler handler);  // id > 0
+bool CancelInterrupt(int id);
+
+// Returns if interrupts were enabled before.
+bool DisableInterrupts();
+void EnableInterrupts();
+
+}  // namespace sim
+
+#endif  // SIM_HAL_H
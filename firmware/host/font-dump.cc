@@ -0,0 +1,112 @@
+// Prints the pixels of each glyph in the firmware fonts, to compare the
+// fonts generated by make-glyph-font.py with what bdfont-data-gen made of
+// the same BDF sources before (see "make check-fonts").
+//
+// Built as is, it draws the glyphs of glyph-font.h. With -DBDFONT_DATA and
+// the bdfont-data-gen output first in the include path, it emits the bytes
+// of each glyph with BDFONT_EMIT_GLYPH() the way the firmware drew text
+// with it: stripes of 8 pixel rows, bit 0 on top.
+//
+// Trailing blank rows are left out: bdfont rounds the height up to 8.
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef BDFONT_DATA
+#include "bdfont-support.h"
+#else
+#include "glyph-font.h"
+#endif
+
+#include "font-6x9.h"
+#include "font-large.h"
+#include "font-message.h"
+#include "font-timetext.h"
+
+namespace {
+using Bitmap = std::vector<std::string>;
+
+// Pixels outside the glyph width widen the rows, so that they show.
+void Set(Bitmap *bitmap, int width, int x, int y) {
+  if ((int)bitmap->size() <= y) {
+    bitmap->resize(y + 1, std::string(width, '.'));
+  }
+  std::string &row = (*bitmap)[y];
+  if ((int)row.size() <= x) row.resize(x + 1, '.');
+  row[x] = '#';
+}
+
+#ifdef BDFONT_DATA
+using Font = const struct FontData *;
+
+// Glyph width, or -1 if not in the font.
+int Draw(Font font, uint16_t codepoint, Bitmap *bitmap) {
+  const auto *glyph = bdfont_find_glyph(font, codepoint);
+  if (!glyph) return -1;
+  const int width = glyph->width;
+  int dx = 0;
+  BDFONT_EMIT_GLYPH(
+      font, codepoint, true, { dx = 0; },
+      {
+        for (int i = 0; i < 8; ++i) {
+          if (b & (1 << i)) Set(bitmap, width, dx, stripe * 8 + i);
+        }
+        ++dx;
+      },
+      {});
+  return width;
+}
+#else
+using Font = const GlyphFont *;
+
+// From the columns; the scanlines have to show the same, or the glyph is
+// marked.
+int Draw(Font font, uint16_t codepoint, Bitmap *bitmap) {
+  const Glyph *glyph = font->Find(codepoint);
+  if (!glyph) return -1;
+  Bitmap from_scanlines;
+  const uint64_t *scanline = font->bits + glyph->scanlines;
+  for (int y = 0; y < font->height; ++y) {
+    for (int word = 0; word < font->words_per_scanline; ++word, ++scanline) {
+      for (int i = 0; i < 64; ++i) {
+        if (*scanline & (uint64_t{1} << (63 - i))) {
+          Set(&from_scanlines, glyph->width, 64 * word + i, y);
+        }
+      }
+    }
+  }
+  const uint64_t *column = font->bits + glyph->columns;
+  for (int x = 0; x < glyph->width; ++x) {
+    for (int word = 0; word < font->words_per_column; ++word, ++column) {
+      for (int i = 0; i < 64; ++i) {
+        if (*column & (uint64_t{1} << i)) {
+          Set(bitmap, glyph->width, x, 64 * word + i);
+        }
+      }
+    }
+  }
+  if (from_scanlines != *bitmap) bitmap->push_back("scanlines differ");
+  return glyph->width;
+}
+#endif
+
+void DumpFont(const char *name, Font font) {
+  for (int codepoint = 0; codepoint < 256; ++codepoint) {
+    Bitmap bitmap;
+    const int width = Draw(font, codepoint, &bitmap);
+    if (width < 0) continue;
+    printf("%s U+%04X width %d\n", name, codepoint, width);
+    for (const std::string &row : bitmap) printf("  %s\n", row.c_str());
+  }
+}
+}  // namespace
+
+int main() {
+  DumpFont("6x9", &font_6x9);
+  DumpFont("large", &font_large);
+  DumpFont("message", &font_message);
+  DumpFont("timetext", &font_timetext);
+  return 0;
+}
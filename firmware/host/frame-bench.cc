@@ -0,0 +1,817 @@
+// Microbenchmark of preparing rows for the wire: the per-row path (interleave
+// and bit-by-bit remap on each tick) vs. FrameBuffer::Finalize() that does
+// it for the whole image up front, the cost of decoding compressed rows
+// while printing compared to the time between ticks, and drawing text pixel
+// by pixel vs. blitting whole glyph rows. Also verifies all of them emit
+// identical bits, that grayscale rows are exposed plane by plane, that a
+// display list drawn while printing gives the rows drawn up front, that rows
+// streamed while printing go out in order, and that a frame committed from
+// another thread is swapped in at the given row.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bitmap-contents.h"
+#include "font-large.h"
+#include "font-timetext.h"
+#include "frame-printer.h"
+#include "glyph-font.h"
+#include "gray-frame.h"
+#include "pico/time.h"
+#include "sim-hal.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int kImageRows = 500;  // Random rows don't compress; this fits.
+constexpr int kRepetitions = 2000;
+constexpr size_t kLongImageRows = 5000;  // 4 meters
+
+// Time between ticks at the fastest pull we aim for: 0.8mm at 300mm/s.
+constexpr double kTickBudgetNanos = 0.8 / 300 * 1e9;
+
+constexpr auto kPreparedRows =
+    FrameBuffer::Prepare<FrameBuffer::PreparedSize(kJollyWrencherBitmap)>(
+        kJollyWrencherBitmap);
+
+// Previous implementation: done for each row when it was sent.
+uint16_t ReferenceMapChipBits(uint16_t data) {
+  constexpr uint8_t newpos[] = {7, 8,  6, 9,  5, 10, 4, 11,
+                                3, 12, 2, 13, 1, 14, 0, 15};
+  uint16_t result = 0;
+  for (uint8_t i = 0; i < 16; ++i) {
+    if (data & (1 << i)) result |= (1 << newpos[i]);
+  }
+  return result;
+}
+
+uint64_t ReferencePhysicalRow(const std::vector<uint64_t> &rows, int row) {
+  uint64_t bits = 0;
+  if (row < (int)rows.size()) bits = rows[row] & 0x5555'5555'5555'5555;
+  if (row >= 4) bits |= rows[row - 4] & 0xAAAA'AAAA'AAAA'AAAA;
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 16) {
+    result |= (uint64_t)ReferenceMapChipBits(bits >> shift) << shift;
+  }
+  return result;
+}
+
+// Previous text drawing: SetPixel() for each pixel of the glyph.
+template <typename Canvas>
+int ReferenceDrawGlyph(Canvas *out, const GlyphFont &font, int x, int y,
+                       uint16_t codepoint) {
+  const Glyph *glyph = font.Find(codepoint);
+  if (!glyph) return 0;
+  const uint64_t *column = font.bits + glyph->columns;
+  for (int gx = 0; gx < glyph->width; ++gx, column += font.words_per_column) {
+    for (int gy = 0; gy < font.height; ++gy) {
+      out->SetPixel(x + gx, y + gy, (column[gy / 64] >> (gy % 64)) & 1);
+    }
+  }
+  return glyph->width;
+}
+
+using DrawFun = int (*)(FrameBuffer *, const GlyphFont &, int, int,
+                        uint16_t);
+
+// Text as in the "Supercon" and time content.
+void DrawSupercon(FrameBuffer *frame, DrawFun draw) {
+  frame->StartNewImage(ScreenAspect::kAlongLength);
+  int x = 0;
+  for (const char *txt = "Supercon 8"; *txt; ++txt) {
+    x += draw(frame, font_large, x, 8, *txt);
+  }
+  frame->Finalize();
+}
+
+void DrawTime(FrameBuffer *frame, DrawFun draw) {
+  frame->StartNewImage(ScreenAspect::kAlongWidth);
+  int x = 2;
+  for (const char *txt = "13:37"; *txt; ++txt) {
+    x += draw(frame, font_timetext, x, 22, *txt);
+  }
+  frame->Finalize();
+}
+
+// Time drawing with both ways; verify they result in the same rows.
+bool CompareText(const char *name, void (*render)(FrameBuffer *, DrawFun)) {
+  static FrameBuffer pixel_frame;
+  static FrameBuffer blit_frame;
+  constexpr int kTextRepetitions = 200;
+  auto start = Clock::now();
+  for (int r = 0; r < kTextRepetitions; ++r) {
+    render(&pixel_frame, ReferenceDrawGlyph);
+  }
+  const auto pixel_time = Clock::now() - start;
+  start = Clock::now();
+  for (int r = 0; r < kTextRepetitions; ++r) render(&blit_frame, DrawGlyph);
+  const auto blit_time = Clock::now() - start;
+
+  const double pixel_us =
+      std::chrono::duration<double, std::micro>(pixel_time).count() /
+      kTextRepetitions;
+  const double blit_us =
+      std::chrono::duration<double, std::micro>(blit_time).count() /
+      kTextRepetitions;
+  const RowData &a = pixel_frame.physical_rows();
+  const RowData &b = blit_frame.physical_rows();
+  const bool same = a.rows == b.rows && a.size == b.size &&
+                    memcmp(a.bytes, b.bytes, a.size) == 0;
+  printf("%-16s %9.1f %9.1f %8.1fx  %s\n", name, pixel_us, blit_us,
+         pixel_us / blit_us, same ? "OK" : "FAIL");
+  return same;
+}
+
+// Collects the bits arriving at the shift registers.
+class WireCapture : public sim::Board {
+ public:
+  bool ReadPin(int, uint64_t) final { return false; }
+  void WritePin(int, bool, uint64_t) final {}
+  void SpiWrite(const uint8_t *data, size_t len, uint64_t, uint64_t) final {
+    uint64_t row = 0;
+    for (size_t i = 0; i < len; ++i) row = (row << 8) | data[i];
+    rows.push_back(row);
+    last.assign(data, data + len);
+  }
+  std::vector<uint64_t> rows;
+  std::vector<uint8_t> last;  // All bytes of the last row.
+};
+
+// Print the frame and compare the wire with the per-row reference.
+bool CheckWire(FramePrinter *printer, FrameBuffer *frame,
+               const std::vector<uint64_t> &image, WireCapture *wire,
+               const char *name) {
+  wire->rows.clear();
+  for (printer->SendStart(frame); printer->SendNext(); /**/) {
+    printer->LightFlash(0);
+  }
+  const int rows = image.size() + 4;
+  int mismatch = wire->rows.size() == (size_t)rows + 1 ? 0 : 1;
+  for (int row = rows - 1, i = 0; row >= 0; --row, ++i) {
+    if (i >= (int)wire->rows.size() ||
+        wire->rows[i] != ReferencePhysicalRow(image, row)) {
+      ++mismatch;
+    }
+  }
+  printf("%-28s %s (%d rows differ)\n", name, mismatch ? "FAIL" : "OK",
+         mismatch);
+  return mismatch == 0;
+}
+
+// Seek() back and forth as when the tape is pulled back and forth must give
+// the same rows as decoding last to first.
+bool CheckSeek(const RowData &rows, const char *name) {
+  std::vector<uint64_t> expected(rows.rows);
+  for (RowReader reader(rows); reader.index() >= 0; reader.Prev()) {
+    expected[reader.index()] = *reader.row();
+  }
+  std::mt19937 rnd(7);
+  RowReader reader(rows);
+  int row = rows.rows - 1;
+  int mismatch = 0;
+  for (int i = 0; i < 20000; ++i) {
+    const int step = (rnd() % 4 == 0) ? rnd() % 600 : -1;  // Mostly forward.
+    row = std::clamp(row + step, 0, rows.rows - 1);
+    reader.Seek(row);
+    if (reader.index() != row || *reader.row() != expected[row]) ++mismatch;
+    if (row == 0) row = rows.rows - 1;
+  }
+  printf("%-28s %s (%d seeks differ)\n", name, mismatch ? "FAIL" : "OK",
+         mismatch);
+  return mismatch == 0;
+}
+
+// Records rows latched in the shift registers and the light pulses.
+class ExposureCapture : public sim::Board {
+ public:
+  struct Pulse {
+    uint64_t start;
+    uint64_t end;
+  };
+
+  bool ReadPin(int, uint64_t) final { return false; }
+  void WritePin(int gpio, bool value, uint64_t now_ns) final {
+    if (gpio != 8) return;  // Light flash, ~OE
+    if (!value) {
+      pulses.push_back({now_ns, 0});
+    } else if (!pulses.empty() && pulses.back().end == 0) {
+      pulses.back().end = now_ns;
+    }
+  }
+  void SpiWrite(const uint8_t *data, size_t len, uint64_t,
+                uint64_t end_ns) final {
+    uint64_t row = 0;
+    memcpy(&row, data, std::min(len, sizeof(row)));
+    latches.push_back({end_ns, row});
+  }
+
+  // Row in the shift registers at the given time.
+  uint64_t LatchedAt(uint64_t t) const {
+    uint64_t row = 0;
+    for (const auto &latch : latches) {
+      if (latch.first <= t) row = latch.second;
+    }
+    return row;
+  }
+
+  std::vector<Pulse> pulses;
+  std::vector<std::pair<uint64_t, uint64_t>> latches;  // Time, row.
+};
+
+// Print a grayscale image with flashes of the given time. Each row must be
+// exposed plane by plane, most significant first, with the planned
+// exposure times, and all of it done within the flash time.
+bool CheckExposures(const GrayFrame &gray, uint32_t flash_usec) {
+  constexpr uint64_t kSlackNanos = 20'000;  // Interrupt entries and such.
+  std::vector<uint64_t> expected[kGrayPlanes];
+  for (int p = 0; p < kGrayPlanes; ++p) {
+    expected[p].resize(gray.planes[p].rows);
+    for (RowReader reader(gray.planes[p]); reader.index() >= 0;
+         reader.Prev()) {
+      expected[p][reader.index()] = *reader.row();
+    }
+  }
+  uint32_t plan[kGrayPlanes] = {};
+  const int planes = FramePrinter::PlanExposures(flash_usec, kGrayPlanes,
+                                                 plan);
+
+  ExposureCapture board;
+  sim::Install(&board, {}, UINT64_MAX);
+  FramePrinter printer(11, spi1);
+  int mismatch = 0;
+  printer.SendStart(gray);
+  for (int row = gray.planes[0].rows - 1; printer.SendNext(); --row) {
+    const size_t first = board.pulses.size();
+    printer.LightFlash(flash_usec);
+    sleep_us(flash_usec + 100);
+    if (board.pulses.size() - first != (size_t)planes ||
+        printer.exposures() != planes) {
+      ++mismatch;
+      continue;
+    }
+    for (int p = 0; p < planes; ++p) {
+      const ExposureCapture::Pulse &pulse = board.pulses[first + p];
+      const int64_t usec = (pulse.end - pulse.start) / 1000;
+      if (board.LatchedAt(pulse.start) != expected[p][row] ||
+          std::abs(usec - (int64_t)plan[p]) > 1) {
+        ++mismatch;
+      }
+    }
+    if (board.pulses.back().end - board.pulses[first].start >
+        flash_usec * 1000 + kSlackNanos) {
+      ++mismatch;
+    }
+  }
+  printf("%6u us  %d planes  %5u %5u %5u us  %s (%d rows differ)\n",
+         (unsigned)flash_usec, planes, (unsigned)plan[0], (unsigned)plan[1],
+         (unsigned)plan[2], mismatch ? "FAIL" : "OK", mismatch);
+  return mismatch == 0;
+}
+
+// Rows of the data, first to last.
+std::vector<uint64_t> DecodeRows(const RowData &data) {
+  std::vector<uint64_t> rows(data.rows);
+  for (RowReader reader(data); reader.index() >= 0; reader.Prev()) {
+    rows[reader.index()] = *reader.row();
+  }
+  return rows;
+}
+
+// Print the first frame, with the second committed from another thread
+// meanwhile. Flashes must show the first frame down to at_row, then, after
+// blank rows for a negative at_row, all of the second; no row may be latched
+// while the LEDs are on.
+bool CheckCommit(FrameBuffer *first, FrameBuffer *second, int at_row) {
+  first->Finalize();
+  second->Finalize();
+  const std::vector<uint64_t> first_rows = DecodeRows(first->physical_rows());
+  std::vector<uint64_t> expected(
+      first_rows.begin() + std::max(at_row, 0), first_rows.end());
+  std::reverse(expected.begin(), expected.end());
+  std::vector<uint64_t> second_rows = DecodeRows(second->physical_rows());
+  expected.insert(expected.end(), second_rows.rbegin(), second_rows.rend());
+
+  ExposureCapture board;
+  sim::Install(&board, {}, UINT64_MAX);
+  FramePrinter printer(11, spi1);
+  printer.SendStart(first);
+  std::thread other_core([&]() { printer.Commit(second, at_row); });
+  other_core.join();
+  std::vector<uint64_t> flashed;
+  int unlit = 0;
+  int gap = 0;  // Rows not flashed before the last flash.
+  const int calls = expected.size() + std::max(-at_row, 0) + 5;
+  for (int i = 0; i < calls; ++i) {
+    if (!printer.SendNext()) {
+      ++unlit;
+      continue;
+    }
+    gap = unlit;
+    printer.LightFlash(200);
+    sleep_us(300);
+    flashed.push_back(board.LatchedAt(board.pulses.back().start));
+  }
+  int mismatch = std::abs((int)flashed.size() - (int)expected.size());
+  for (size_t i = 0; i < std::min(flashed.size(), expected.size()); ++i) {
+    mismatch += flashed[i] != expected[i];
+  }
+  for (const auto &latch : board.latches) {  // Changed while lit: torn row.
+    for (const ExposureCapture::Pulse &pulse : board.pulses) {
+      mismatch += latch.first > pulse.start && latch.first < pulse.end;
+    }
+  }
+  const bool ok = mismatch == 0 && gap == std::max(-at_row, 0) &&
+                  printer.frame() == second;
+  printf("Commit at row %-4d %4zu rows, %2d blank  %s (%d rows differ)\n",
+         at_row, flashed.size(), gap, ok ? "OK" : "FAIL", mismatch);
+  return ok;
+}
+
+// A display list, drawn row by row while printing, must flash the same rows
+// as its text drawn on a frame up front, and so must the list drawn into
+// stored rows with DrawDisplayList(). Each row is drawn ahead
+// while the LEDs are on, so it is latched right at the end of the flash
+// before; nothing may be latched while they are on. Also times drawing a
+// row, compared to the time between ticks.
+bool CheckDisplayList(const char *name, ScreenAspect aspect) {
+  constexpr uint64_t kLatchNanos = 100'000;  // Shift out, with slack.
+  static FrameBuffer drawn;
+  static FrameBuffer listed;
+  static FrameBuffer baked;
+  drawn.StartNewImage(aspect);
+  FrameBuffer::DisplayList_t &list = listed.StartDisplayList(aspect);
+  constexpr uint32_t kBakedKey = 1;
+  FrameBuffer::DisplayList_t &baked_list =
+      baked.StartDisplayList(aspect, kBakedKey);
+  auto text = [&](const GlyphFont &font, int x, int y, const char *txt,
+                  bool right_aligned, int extra_space) {
+    WriteText(&drawn, font, x, y, txt, right_aligned, extra_space);
+    list.AddText(font, x, y, txt, right_aligned, extra_space);
+    baked_list.AddText(font, x, y, txt, right_aligned, extra_space);
+  };
+  // Drawn roughly front to back: the canvas only holds the last rows.
+  constexpr int kBitmapRow = 30;
+  for (size_t i = 0; i < std::size(kJollyWrencherBitmap); ++i) {
+    drawn.at(kBitmapRow + i) |= kJollyWrencherBitmap[i];
+  }
+  list.AddBitmap(kJollyWrencherBitmap, kBitmapRow);
+  baked_list.AddBitmap(kJollyWrencherBitmap, kBitmapRow);
+  text(font_timetext, 62, 40, "13:37", true, 0);
+  text(font_timetext, 20, 90, "12:59", false, 0);
+  text(font_large, 1, 3, "Supercon 8", false, 1);
+  drawn.Finalize();
+  listed.Finalize();
+  baked.DrawDisplayList();
+  baked.Finalize();
+
+  std::vector<uint64_t> expected = DecodeRows(drawn.physical_rows());
+  int mismatch = DecodeRows(baked.physical_rows()) != expected;
+  // Shown again, the rows drawn are kept.
+  mismatch += !baked.ReuseDisplayList(kBakedKey) || baked.display_list() ||
+              DecodeRows(baked.physical_rows()) != expected;
+  std::reverse(expected.begin(), expected.end());
+  ExposureCapture board;
+  sim::Install(&board, {}, UINT64_MAX);
+  FramePrinter printer(11, spi1);
+  std::vector<uint64_t> flashed;
+  for (printer.SendStart(&listed); printer.SendNext(); /**/) {
+    printer.LightFlash(200);
+    printer.DrawAhead();
+    sleep_us(300);
+    flashed.push_back(board.LatchedAt(board.pulses.back().start));
+  }
+  mismatch += std::abs((int)flashed.size() - (int)expected.size());
+  for (size_t i = 0; i < std::min(flashed.size(), expected.size()); ++i) {
+    mismatch += flashed[i] != expected[i];
+  }
+  int late = 0;  // Rows not latched at the end of the flash before.
+  for (const ExposureCapture::Pulse &pulse : board.pulses) {
+    bool latched = false;
+    for (const auto &latch : board.latches) {
+      mismatch += latch.first > pulse.start && latch.first < pulse.end;
+      latched |= latch.first >= pulse.end &&
+                 latch.first < pulse.end + kLatchNanos;
+    }
+    late += !latched;
+  }
+
+  volatile uint64_t sink = 0;
+  const auto start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    FrameBuffer::ListReader reader(listed.display_list());
+    for (int row = listed.size() - 1; row >= 0; --row) {
+      reader.Seek(row);
+      sink = sink + *reader.row();
+    }
+  }
+  const double ns = std::chrono::duration<double, std::nano>(
+                        Clock::now() - start).count() / kRepetitions /
+                    listed.size();
+  const bool ok = mismatch == 0 && late == 0;
+  printf("%-16s %6zu %10.2f %9.4f%%  %s (%d rows differ, %d late)\n", name,
+         listed.size(), ns, 100 * ns / kTickBudgetNanos, ok ? "OK" : "FAIL",
+         mismatch, late);
+  return ok;
+}
+
+// Rows streamed while printing go out in the order they are pushed, paired
+// for the even/odd line offset like the rows of a frame, last image row
+// first. The feeder pushes a row per flash, starting with ahead rows queued
+// and pausing for the first late flashes: rows it is late for are blank and
+// counted as underruns. Printing stops four rows after the last.
+bool CheckStream(const char *name, int ahead, int late) {
+  constexpr int kRows = 300;
+  static FrameBuffer::RowStream_t stream;
+  std::mt19937_64 rnd(7);
+  std::vector<uint64_t> rows(kRows);
+  for (uint64_t &row : rows) row = rnd();
+
+  ExposureCapture board;
+  sim::Install(&board, {}, UINT64_MAX);
+  FramePrinter printer(11, spi1);
+  std::vector<uint64_t> printed;  // Model: rows as taken, blank if none.
+  int queued = 0;
+  int underruns = 0;
+  size_t pushed = 0;
+  auto push = [&]() {
+    if (pushed == rows.size()) return;
+    stream.Push(rows[pushed++]);
+    ++queued;
+    if (pushed == rows.size()) stream.End();
+  };
+  auto take = [&]() {  // Where the printer takes the next row.
+    if (pushed == rows.size() && queued == 0) return;
+    printed.push_back(queued > 0 ? rows[pushed - queued] : 0);
+    underruns += queued == 0;
+    queued -= queued > 0;
+  };
+  stream.Start();
+  for (int i = 0; i < ahead; ++i) push();
+  printer.SendStart(&stream);
+  take();
+  std::vector<uint64_t> flashed;
+  for (int i = 0; printer.SendNext(); ++i) {
+    printer.LightFlash(200);
+    sleep_us(300);
+    flashed.push_back(board.LatchedAt(board.pulses.back().start));
+    take();  // At the end of the flash.
+    if (i >= late) push();
+  }
+
+  std::reverse(printed.begin(), printed.end());  // As rows of an image.
+  const int expected = printed.size() + 4;
+  int mismatch = std::abs((int)flashed.size() - expected);
+  for (int i = 0; i < std::min((int)flashed.size(), expected); ++i) {
+    const uint64_t wire = ReferencePhysicalRow(printed, expected - 1 - i);
+    mismatch += flashed[i] != __builtin_bswap64(wire);  // Bytes as sent.
+  }
+  const bool ok = mismatch == 0 && (int)stream.underruns() == underruns &&
+                  !printer.streaming();
+  printf("%-20s %5zu rows, %3u underruns  %s (%d rows differ)\n", name,
+         flashed.size(), (unsigned)stream.underruns(), ok ? "OK" : "FAIL",
+         mismatch);
+  return ok;
+}
+
+void PrintDecodeCost(const char *name, const RowData &rows) {
+  volatile uint64_t sink = 0;
+  const auto start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    for (RowReader reader(rows); reader.index() >= 0; reader.Prev()) {
+      sink = sink + *reader.row();
+    }
+  }
+  const double ns = std::chrono::duration<double, std::nano>(
+                        Clock::now() - start).count() / kRepetitions /
+                    rows.rows;
+  printf("%-16s %6d %7.2f %9.2f %10.2f %9.4f%%\n", name, rows.rows,
+         rows.rows * 0.8 / 1000, double(rows.size) / rows.rows, ns,
+         100 * ns / kTickBudgetNanos);
+}
+
+double NanosPerRow(Clock::duration d) {
+  return std::chrono::duration<double, std::nano>(d).count() / kRepetitions /
+         kImageRows;
+}
+
+// Rows of a frame, first to last, as stored for the wire.
+template <typename Row>
+std::vector<Row> StoredRows(const BasicRowData<Row> &data) {
+  std::vector<Row> result(data.rows);
+  for (BasicRowReader<Row> reader(data); reader.index() >= 0; reader.Prev()) {
+    result[reader.index()] = *reader.row();
+  }
+  return result;
+}
+
+// Chained panels: a random image must give the rows of single panel frames
+// holding each a slice of it, the rightmost first on the wire; text blitted
+// across the panel boundaries the same rows as drawn pixel by pixel.
+template <int kPanels>
+bool CheckPanels(std::mt19937_64 *rnd) {
+  using Wide = BasicFrameBuffer<kPanels>;
+  static Wide frame;
+  static FrameBuffer slices[kPanels];
+  std::vector<std::vector<bool>> pixels(kImageRows,
+                                        std::vector<bool>(Wide::kColumns));
+  for (auto &row : pixels) {
+    for (size_t x = 0; x < row.size(); ++x) row[x] = (*rnd)() & 1;
+  }
+  for (int p = 0; p < kPanels; ++p) {
+    slices[p].StartNewImage(ScreenAspect::kAlongWidth);
+    for (int y = 0; y < kImageRows; ++y) {
+      for (int x = 0; x < 64; ++x) {
+        slices[p].SetPixel(x, y, pixels[y][64 * p + x]);
+      }
+    }
+    slices[p].Finalize();
+  }
+  frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (int y = 0; y < kImageRows; ++y) {
+    for (int x = 0; x < Wide::kColumns; ++x) frame.SetPixel(x, y, pixels[y][x]);
+  }
+  frame.Finalize();
+  const auto wide_rows = StoredRows(frame.physical_rows());
+  int mismatch = 0;
+  for (int p = 0; p < kPanels; ++p) {
+    const auto slice_rows = StoredRows(slices[p].physical_rows());
+    if (slice_rows.size() != wide_rows.size()) {
+      ++mismatch;
+      continue;
+    }
+    for (size_t r = 0; r < wide_rows.size(); ++r) {
+      mismatch += RowWord(wide_rows[r], kPanels - 1 - p) != slice_rows[r];
+    }
+  }
+
+  // Encoding and decoding cost per row of the random image.
+  std::vector<typename Wide::RowBits_t> image(kImageRows);
+  for (auto &row : image) {
+    for (int w = 0; w < kPanels; ++w) RowWord(row, w) = (*rnd)();
+  }
+  auto start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    frame.StartNewImage(ScreenAspect::kAlongWidth);
+    for (const auto &row : image) frame.push_back(row);
+  }
+  const auto fill_time = Clock::now() - start;
+  start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    frame.StartNewImage(ScreenAspect::kAlongWidth);
+    for (const auto &row : image) frame.push_back(row);
+    frame.Finalize();
+  }
+  const double finalize_ns = NanosPerRow(Clock::now() - start - fill_time);
+  const auto data = frame.physical_rows();
+  volatile uint64_t sink = 0;
+  start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    for (BasicRowReader<typename Wide::RowBits_t> reader(data);
+         reader.index() >= 0; reader.Prev()) {
+      sink = sink + RowWord(*reader.row(), 0);
+    }
+  }
+  const double decode_ns = NanosPerRow(Clock::now() - start);
+
+  static Wide pixel_frame;
+  for (Wide *f : {&pixel_frame, &frame}) {
+    f->StartNewImage(ScreenAspect::kAlongLength);
+  }
+  // Lines across the panel boundaries, drawn glyph by glyph as the canvas
+  // only holds the last rows.
+  int x = 0;
+  for (const char *txt = "Supercon 8"; *txt; ++txt) {
+    int width = 0;
+    for (int y = 0; y < Wide::kColumns; y += 96) {  // Not overlapping.
+      ReferenceDrawGlyph(&pixel_frame, font_large, x, y, *txt);
+      width = DrawGlyph(&frame, font_large, x, y, *txt);
+    }
+    x += width;
+  }
+  pixel_frame.Finalize();
+  frame.Finalize();
+  const bool text_same = StoredRows(pixel_frame.physical_rows()) ==
+                         StoredRows(frame.physical_rows());
+  mismatch += !text_same;
+
+  printf("%6d %7d %9.2f %11.2f %10.2f  %s (%d rows differ)\n", kPanels,
+         Wide::kColumns, double(data.size) / data.rows, finalize_ns, decode_ns,
+         mismatch ? "FAIL" : "OK", mismatch);
+  return mismatch == 0;
+}
+
+// Panels on PIO lanes compared to all of them chained on SPI: time to shift
+// out and latch a row on the simulated clock, and the bits arriving being
+// the row. Taken apart again, the bits of each lane must be those of its
+// panels as chained for SPI.
+template <int kPanels, int kLanes>
+bool CompareOutput(SpiRowOutput *spi, PIO pio, WireCapture *wire,
+                   std::mt19937_64 *rnd) {
+  static PioRowOutput<kPanels, kLanes> lanes(11, pio);
+  static BasicFrameBuffer<kPanels> chained_frame;
+  static BasicFrameBuffer<kPanels, kLanes> lanes_frame;
+  std::vector<typename BasicFrameBuffer<kPanels>::RowBits_t> image(
+      kImageRows);
+  for (auto &row : image) {
+    for (int w = 0; w < kPanels; ++w) RowWord(row, w) = (*rnd)();
+  }
+  chained_frame.StartNewImage(ScreenAspect::kAlongWidth);
+  lanes_frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (const auto &row : image) {
+    chained_frame.push_back(row);
+    lanes_frame.push_back(row);
+  }
+  chained_frame.Finalize();
+  lanes_frame.Finalize();
+  const auto chained = StoredRows(chained_frame.physical_rows());
+  const auto interleaved = StoredRows(lanes_frame.physical_rows());
+
+  constexpr int kLaneBits = 64 * kPanels / kLanes;
+  auto bit = [](const auto &row, int i) {
+    return (reinterpret_cast<const uint8_t *>(&row)[i / 8] >> (7 - i % 8)) & 1;
+  };
+  int mismatch = chained.size() == interleaved.size() ? 0 : 1;
+  for (size_t r = 0; r < std::min(chained.size(), interleaved.size()); ++r) {
+    for (int i = 0; i < 64 * kPanels; ++i) {
+      const int lane = kLanes - 1 - i % kLanes;
+      const int chained_bit = (kLanes - 1 - lane) * kLaneBits + i / kLanes;
+      mismatch += bit(interleaved[r], i) != bit(chained[r], chained_bit);
+    }
+  }
+
+  // Latch a row the way FramePrinter does; microseconds until done.
+  auto latch = [&](auto *output, const void *row) {
+    const uint64_t start = sim::NowNanos();
+    output->Send(row, sizeof(chained[0]));
+    output->WaitLatched();
+    mismatch += wire->last.size() != sizeof(chained[0]) ||
+                memcmp(wire->last.data(), row, sizeof(chained[0])) != 0;
+    return (sim::NowNanos() - start) / 1000.0;
+  };
+  const double spi_us = latch(spi, &chained[chained.size() / 2]);
+  const double pio_us = latch(&lanes, &interleaved[interleaved.size() / 2]);
+  printf("%6d %5d %9.1f %9.1f %8.1fx  %s (%d bits differ)\n", kPanels,
+         kLanes, spi_us, pio_us, spi_us / pio_us, mismatch ? "FAIL" : "OK",
+         mismatch);
+  return mismatch == 0;
+}
+}  // namespace
+
+int main() {
+  std::mt19937_64 rnd(42);
+  std::vector<uint64_t> image(kImageRows);
+  for (uint64_t &row : image) row = rnd();
+
+  WireCapture wire;
+  sim::Install(&wire, {}, UINT64_MAX);
+  static FramePrinter printer(11, spi1);
+  static FrameBuffer frame;
+
+  // Per-row path: interleave + remap every row when it is sent.
+  volatile uint64_t sink = 0;
+  auto start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    for (int row = kImageRows + 3; row >= 0; --row) {
+      sink = sink + ReferencePhysicalRow(image, row);
+    }
+  }
+  const double per_row_ns = NanosPerRow(Clock::now() - start);
+
+  // Filling the image alone, to be subtracted from the Finalize() timing.
+  start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    frame.StartNewImage(ScreenAspect::kAlongWidth);
+    for (uint64_t row : image) frame.push_back(row);
+  }
+  const double fill_ns = NanosPerRow(Clock::now() - start);
+
+  start = Clock::now();
+  for (int r = 0; r < kRepetitions; ++r) {
+    frame.StartNewImage(ScreenAspect::kAlongWidth);
+    for (uint64_t row : image) frame.push_back(row);
+    frame.Finalize();
+  }
+  const double finalize_ns = NanosPerRow(Clock::now() - start) - fill_ns;
+
+  printf("%-28s %8.2f ns/row\n", "per-row interleave+remap", per_row_ns);
+  printf("%-28s %8.2f ns/row\n", "Finalize() whole image", finalize_ns);
+  printf("%-28s %8.2fx\n", "speedup", per_row_ns / finalize_ns);
+
+  // Same bits on the wire as the per-row reference.
+  int failures = 0;
+  frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (uint64_t row : image) frame.push_back(row);
+  failures += !CheckWire(&printer, &frame, image, &wire, "random image");
+
+  const std::vector<uint64_t> bitmap(std::begin(kJollyWrencherBitmap),
+                                     std::end(kJollyWrencherBitmap));
+  frame.UsePrepared(kPreparedRows.data());
+  failures += !CheckWire(&printer, &frame, bitmap, &wire, "prepared bitmap");
+
+  // Several meters of bitmaps with some blank tape in between.
+  std::vector<uint64_t> long_image;
+  while (long_image.size() < kLongImageRows) {
+    long_image.insert(long_image.end(), bitmap.begin(), bitmap.end());
+    long_image.resize(long_image.size() + 450);
+  }
+  frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (uint64_t row : long_image) frame.push_back(row);
+  failures += !CheckWire(&printer, &frame, long_image, &wire, "long image");
+  frame.Finalize();
+  failures += !CheckSeek(frame.physical_rows(), "long image seek");
+
+  // Decoding one row when sending it, compared to the time between ticks.
+  printf("\nDecode per row; tick at 300mm/s is %.0f us\n",
+         kTickBudgetNanos / 1000);
+  printf("%-16s %6s %7s %9s %10s %10s\n", "image", "rows", "meters",
+         "bytes/row", "ns/row", "of tick");
+  frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (uint64_t row : image) frame.push_back(row);
+  frame.Finalize();
+  PrintDecodeCost("random image", frame.physical_rows());
+  PrintDecodeCost("prepared bitmap", kPreparedRows.data());
+  frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (uint64_t row : long_image) frame.push_back(row);
+  frame.Finalize();
+  PrintDecodeCost("long image", frame.physical_rows());
+
+  // Text, including the Finalize() that follows it.
+  printf("\nText rendering, us per image\n");
+  printf("%-16s %9s %9s %9s\n", "text", "per-pixel", "blit", "speedup");
+  failures += !CompareText("Supercon large", DrawSupercon);
+  failures += !CompareText("time", DrawTime);
+
+  // Grayscale: exposure per plane at flash times from slow to fast pulls.
+  printf("\nGrayscale exposures, most significant plane first\n");
+  static GrayImage<40> gray_image(ScreenAspect::kAlongWidth);
+  for (int y = 0; y < 40; ++y) {
+    for (int x = 0; x < 64; ++x) gray_image.SetPixel(x, y, rnd() % kGrayLevels);
+  }
+  static FrameBuffer gray_planes[kGrayPlanes];
+  GrayFrame gray;
+  for (int p = 0; p < kGrayPlanes; ++p) {
+    gray_planes[p].StartNewImage(ScreenAspect::kAlongWidth);
+    for (uint64_t row : gray_image.planes[p]) gray_planes[p].push_back(row);
+    gray_planes[p].Finalize();
+    gray.planes[p] = gray_planes[p].physical_rows();
+  }
+  static_assert(kGrayPlanes == 3, "Table prints three planes");
+  for (uint32_t flash_usec : {5000, 2900, 1500, 800, 300}) {
+    failures += !CheckExposures(gray, flash_usec);
+  }
+
+  // Frame handed over by the other core, swapped in at a row boundary.
+  printf("\nFrame committed while printing\n");
+  static FrameBuffer next_frame;
+  next_frame.UsePrepared(kPreparedRows.data());
+  frame.StartNewImage(ScreenAspect::kAlongWidth);
+  for (uint64_t row : image) frame.push_back(row);
+  for (int at_row : {100, 0, -16}) {
+    failures += !CheckCommit(&frame, &next_frame, at_row);
+  }
+
+  // Content described by a display list instead of drawn up front.
+  printf("\nDisplay list drawn while printing, per row\n");
+  printf("%-16s %6s %10s %10s\n", "image", "rows", "ns/row", "of tick");
+  failures += !CheckDisplayList("list along width", ScreenAspect::kAlongWidth);
+  failures +=
+      !CheckDisplayList("list along length", ScreenAspect::kAlongLength);
+
+  // Rows arriving while printing, as streamed over USB.
+  printf("\nRows streamed while printing\n");
+  failures += !CheckStream("stream kept ahead", 8, 0);
+  failures += !CheckStream("stream late", 0, 20);
+
+  // Wider tape of chained panels; see panel-row.h.
+  printf("\nChained panels, random image\n");
+  printf("%6s %7s %9s %11s %10s\n", "panels", "columns", "bytes/row",
+         "Finalize ns", "decode ns");
+  failures += !CheckPanels<1>(&rnd);
+  failures += !CheckPanels<2>(&rnd);
+  failures += !CheckPanels<4>(&rnd);
+
+  // Panels on lanes of their own shift out in the time of one.
+  printf("\nRow shift-out, SPI chain vs. PIO lanes\n");
+  printf("%6s %5s %9s %9s %9s\n", "panels", "lanes", "SPI us", "PIO us",
+         "speedup");
+  sim::Install(&wire, {}, UINT64_MAX);
+  static SpiRowOutput spi(11, spi0);
+  failures += !CompareOutput<1, 1>(&spi, pio0, &wire, &rnd);
+  failures += !CompareOutput<2, 2>(&spi, pio0, &wire, &rnd);
+  failures += !CompareOutput<4, 2>(&spi, pio1, &wire, &rnd);
+  failures += !CompareOutput<4, 4>(&spi, pio0, &wire, &rnd);
+  failures += !CompareOutput<8, 8>(&spi, pio0, &wire, &rnd);
+
+  printf("RAM per FrameBuffer: %zu bytes (was 8 KiB for at most 1024 rows)\n",
+         sizeof(FrameBuffer));
+  printf("of which display list: %zu bytes; list reader: %zu bytes\n",
+         sizeof(FrameBuffer::DisplayList_t), sizeof(FrameBuffer::ListReader));
+  return failures ? 1 : 0;
+}
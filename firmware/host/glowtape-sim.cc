@@ -0,0 +1,810 @@
+// Host simulation of the glowtape firmware main loop. Replays a synthetic
+// encoder waveform on a virtual clock and reports how well rows keep up with
+// the tape.
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "frame-buffer.h"
+#include "hardware/rtc.h"
+#include "idle-power.h"
+#include "packet-reader.h"
+#include "row-store.h"
+#include "sim-hal.h"
+
+// From glowtape.cc, compiled with main() renamed.
+int glowtape_main();
+void CreateContent(FrameBuffer *out, int what_content);
+extern IdlePower idle_power;
+
+namespace {
+// Pins as used in the firmware.
+constexpr int kButtonPin = 4;
+constexpr int kEncoderPin = 7;
+constexpr int kEncoderQuadraturePin = 6;
+constexpr int kLightFlashPin = 8;
+
+constexpr double kRowPitchMillimeter = 0.8;  // Distance between encoder lines
+constexpr int kWarmupRows = 2;  // main() waits for its predictor to lock.
+constexpr int kRepeatGapRows = 16;  // Blank rows between repeats, as main().
+
+constexpr uint64_t kMsec = 1'000'000;
+
+// Streaming rows as the host does: packets as in glowtape.cc, sent once the
+// ack of the one before came back and after the USB round trip.
+constexpr uint8_t kStreamRows = 'S';
+constexpr uint8_t kStreamEnd = 'Q';
+constexpr int kStreamRowsPerPacket = 64 / kPanelCount;
+constexpr uint64_t kHostTurnaround = 1 * kMsec;
+constexpr uint64_t kCreditPoll = 5 * kMsec;  // Asking again if none free.
+constexpr uint64_t kStreamStop = 100 * kMsec;  // After the pull: rest dropped.
+
+// Bound on waking up from idle: the first edge of a pull is taken care of
+// at full clock before the next edge, even at 300mm/s.
+constexpr double kMaxWakeUsec = 1'000;
+constexpr uint64_t kIdleBeforePull = 1'000 * kMsec;
+
+// Exposures of the bit-planes of a gray row follow each other after the
+// shift-out of the next plane, with no edge in between.
+constexpr uint64_t kMaxPlaneGap = kMsec / 2;
+
+// Same as the firmware build: two encoder channels, rows by tape position.
+#ifndef QUADRATURE_ENCODER
+#define QUADRATURE_ENCODER 0
+#endif
+constexpr bool kQuadratureEncoder = QUADRATURE_ENCODER;
+
+enum class Profile { kConstant, kAccelerate, kJitter };
+
+struct PullParams {
+  Profile profile = Profile::kConstant;
+  double speed = 50;      // mm/s
+  double end_speed = 50;  // mm/s, for kAccelerate
+  double jitter = 0.1;    // Std-deviation as fraction of tick interval.
+  int button_presses = 0;
+  int ticks = -1;  // Number of encoder lines; -1: enough for full image.
+  int back_rows = 0;  // Pause halfway, pull back rows, continue; quadrature.
+  int pause_ms = 0;   // Stop halfway for that long, continue; single channel.
+  const char *command = nullptr;  // Serial command typed after the pull.
+  int repeats = 1;  // Images in one pull, with the "repeat" command.
+  bool half_rows = false;  // With the "halfrows" command.
+  int stream_rows = 0;   // Rows streamed while pulling instead of content.
+  double feed_rate = 0;  // Rows/s the host has rows to stream; 0: any.
+  unsigned seed = 42;
+};
+
+struct Flash {
+  uint64_t start;
+  uint64_t end;
+};
+
+// Tape moved to the next row position.
+struct Tick {
+  uint64_t time;
+  int position;
+};
+
+// Row bits latched into the shift registers.
+struct Latch {
+  uint64_t time;
+  FrameBuffer::RowBits_t row;
+};
+
+// Encoder tape, button and light-flash as seen by the firmware. Also the
+// host streaming rows, if any, over the serial line: rows become available
+// at the feed rate from the start, and are sent as the credit in the acks
+// allows.
+class PullBoard : public sim::Board {
+ public:
+  PullBoard(const PullParams &params, int ticks,
+            const std::vector<FrameBuffer::RowBits_t> &stream = {})
+      : stream_(stream), feed_rate_(params.feed_rate) {
+    uint64_t t = 0;
+    if (params.repeats > 1) typed_.push_back({t, "repeat on\n"});
+    if (params.half_rows) typed_.push_back({t, "halfrows on\n"});
+    for (int i = 0; i < params.button_presses; ++i) {
+      t += 100 * kMsec;
+      presses_.push_back({t, t + 100 * kMsec});
+      t += 100 * kMsec;
+    }
+
+    t = std::max(t + kIdleBeforePull, kIdleBeforePull);
+    std::mt19937 rnd(params.seed);
+    std::normal_distribution<double> jitter(0, params.jitter);
+    for (int i = 0; i < ticks; ++i) {
+      double speed = params.speed;
+      if (params.profile == Profile::kAccelerate) {
+        speed += (params.end_speed - params.speed) * i / ticks;
+      }
+      double period_ns = kRowPitchMillimeter / speed * 1e9;
+      const double high_ns = period_ns / 2;  // Encoder lines at 50% duty.
+      if (params.profile == Profile::kJitter) {
+        period_ns *= std::max(0.6, 1.0 + jitter(rnd));
+      }
+      if (!kQuadratureEncoder) {
+        if (i == ticks / 2) t += params.pause_ms * kMsec;
+        channel_a_.push_back({t, t + (uint64_t)high_ns});
+        ticks_.push_back({t, i + 1});
+        t += period_ns;
+        continue;
+      }
+      if (i == ticks / 2 && params.back_rows > 0) {
+        t += kIdleBeforePull;  // Longer than the encoder timeout.
+        for (int q = 0; q < 4 * params.back_rows; ++q) {
+          QuarterStep(&t, -1, period_ns / 4);
+        }
+        for (int q = 0; q < 4 * params.back_rows; ++q) {
+          QuarterStep(&t, +1, period_ns / 4);
+        }
+      }
+      for (int q = 0; q < 4; ++q) QuarterStep(&t, +1, period_ns / 4);
+    }
+    if (params.command) {
+      typed_.push_back({t + 100 * kMsec, std::string(params.command) + "\n"});
+    }
+    end_ns_ = t + kIdleBeforePull;
+  }
+
+  bool ReadPin(int gpio, uint64_t now_ns) final {
+    switch (gpio) {
+      case kEncoderPin: return InInterval(channel_a_, now_ns);
+      case kEncoderQuadraturePin: return InInterval(channel_b_, now_ns);
+      case kButtonPin: return !InInterval(presses_, now_ns);  // Active low
+    }
+    return false;
+  }
+
+  uint64_t NextPinChange(int gpio, uint64_t after_ns) final {
+    switch (gpio) {
+      case kEncoderPin: return NextChange(channel_a_, after_ns);
+      case kEncoderQuadraturePin: return NextChange(channel_b_, after_ns);
+      case kButtonPin: return NextChange(presses_, after_ns);
+    }
+    return UINT64_MAX;
+  }
+
+  void WritePin(int gpio, bool value, uint64_t now_ns) final {
+    if (gpio != kLightFlashPin) return;
+    if (!value) {  // ~OE
+      flashes_.push_back({now_ns, 0});
+    } else if (!flashes_.empty() && flashes_.back().end == 0) {
+      flashes_.back().end = now_ns;
+    }
+  }
+
+  // The shift registers latch once the last bit is out.
+  void SpiWrite(const uint8_t *data, size_t len, uint64_t,
+                uint64_t end_ns) final {
+    Latch latch = {end_ns, {}};
+    memcpy(&latch.row, data, std::min(len, sizeof(latch.row)));
+    latches_.push_back(latch);
+  }
+
+  int ReadChar(uint64_t now_ns) final {
+    if (packet_pos_ < packet_.size()) return packet_[packet_pos_++];
+    if (typed_pos_ >= typed_.size() || now_ns < typed_[typed_pos_].time) {
+      return NextStreamPacket(now_ns) ? packet_[packet_pos_++] : -1;
+    }
+    const std::string &text = typed_[typed_pos_].text;
+    const char c = text[char_pos_++];
+    if (char_pos_ == text.size()) {
+      ++typed_pos_;
+      char_pos_ = 0;
+    }
+    return c;
+  }
+
+  // Acks of stream packets.
+  void WriteChar(int c, uint64_t now_ns) final {
+    if (stream_.empty()) return sim::Board::WriteChar(c, now_ns);
+    if (c != 0) {
+      ack_.push_back(c);
+      return;
+    }
+    const std::vector<uint8_t> ack = CobsDecode(ack_);
+    ack_.clear();
+    if (ack.size() < 5 || ack[0] != 'A' || ack[1] != seq_) return;
+    awaiting_ack_ = false;
+    next_packet_ns_ = now_ns + kHostTurnaround;
+    if (ack[2] == SerialPackets::kOk) {
+      sent_ += packet_rows_;
+      ended_ = (packet_type_ == kStreamEnd);
+    }
+    if (ack.size() >= 9) {
+      credit_ = ack[3] | ack[4] << 8;
+      underruns_ = ack[5] | ack[6] << 8;
+      if (!ticks_.empty() && now_ns > ticks_.front().time &&
+          now_ns < ticks_.back().time) {
+        min_queued_ = std::min(min_queued_, kStreamCapacity - credit_);
+      }
+    }
+    if (credit_ == 0) next_packet_ns_ = now_ns + kCreditPoll;
+  }
+
+  uint64_t end_ns() const { return end_ns_; }
+  const std::vector<Tick> &ticks() const { return ticks_; }
+  const std::vector<Flash> &flashes() const { return flashes_; }
+  const std::vector<Latch> &latches() const { return latches_; }
+  int underruns() const { return underruns_; }
+  int min_queued() const { return min_queued_; }
+
+ private:
+  using SerialPackets = PacketReader<kStreamRowsPerPacket *
+                                     sizeof(FrameBuffer::RowBits_t)>;
+  static constexpr int kStreamCapacity = FrameBuffer::RowStream_t::kCapacity;
+
+  // Encode the next stream packet into packet_, if it is time: rows up to
+  // the credit, an empty packet to ask for credit, or the end once all rows
+  // are sent.
+  bool NextStreamPacket(uint64_t now_ns) {
+    if (stream_.empty() || ended_ || awaiting_ack_) return false;
+    if (now_ns < next_packet_ns_) return false;
+    size_t ready = stream_.size();
+    if (feed_rate_ > 0) {
+      ready = std::min(ready, (size_t)(feed_rate_ * now_ns / 1e9));
+    }
+    packet_rows_ = std::min({(size_t)credit_, (size_t)kStreamRowsPerPacket,
+                             ready - sent_});
+    // Rows the pull did not take are dropped, not left for the next one.
+    const bool stop = now_ns > ticks_.back().time + kStreamStop;
+    packet_type_ = (stop || sent_ == stream_.size()) ? kStreamEnd : kStreamRows;
+    if (packet_type_ == kStreamRows && packet_rows_ == 0 && credit_ > 0) {
+      next_packet_ns_ = now_ns + kCreditPoll;  // Wait for the source.
+      return false;
+    }
+    std::vector<uint8_t> payload = {packet_type_, ++seq_};
+    if (packet_type_ == kStreamEnd) {
+      packet_rows_ = 0;
+      payload.push_back(stop);
+    }
+    for (size_t r = sent_; r < sent_ + packet_rows_; ++r) {
+      for (int w = 0; w < kPanelCount; ++w) {
+        const uint64_t word = RowWord(stream_[r], w);
+        for (int i = 0; i < 8; ++i) payload.push_back(word >> (8 * i));
+      }
+    }
+    const uint16_t crc = SerialPackets::Crc16(payload.data(), payload.size());
+    payload.push_back(crc >> 8);
+    payload.push_back(crc & 0xff);
+    packet_ = CobsEncode(payload);
+    packet_pos_ = 0;
+    awaiting_ack_ = true;
+    return true;
+  }
+
+  // Framed by zeros on both ends.
+  static std::vector<uint8_t> CobsEncode(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> out = {0, 0};  // Placeholder for the first code.
+    size_t code_pos = 1;
+    for (const uint8_t byte : data) {
+      if (byte != 0) out.push_back(byte);
+      if (byte == 0 || out.size() - code_pos == 0xff) {
+        out[code_pos] = out.size() - code_pos;
+        code_pos = out.size();
+        out.push_back(0);
+      }
+    }
+    out[code_pos] = out.size() - code_pos;
+    out.push_back(0);
+    return out;
+  }
+
+  static std::vector<uint8_t> CobsDecode(const std::vector<uint8_t> &in) {
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < in.size(); /**/) {
+      const uint8_t code = in[i++];
+      for (uint8_t k = 1; k < code && i < in.size(); ++k) {
+        out.push_back(in[i++]);
+      }
+      if (code != 0xff && i < in.size()) out.push_back(0);
+    }
+    return out;
+  }
+
+  // Move the tape a quarter row forward (+1) or back (-1) at time *t, then
+  // advance time by step_ns. Channel A is high for the second half of a row,
+  // B a quarter row earlier; the position changes on the falling edge of A.
+  void QuarterStep(uint64_t *t, int direction, double step_ns) {
+    const int row = quarter_ >> 2;
+    quarter_ += direction;
+    const int phase = quarter_ & 3;
+    SetLevel(&channel_a_, phase >= 2, *t);
+    SetLevel(&channel_b_, phase == 1 || phase == 2, *t);
+    if ((quarter_ >> 2) != row) ticks_.push_back({*t, quarter_ >> 2});
+    *t += step_ns;
+  }
+
+  static void SetLevel(std::vector<Flash> *high, bool level, uint64_t t) {
+    const bool is_high = !high->empty() && high->back().end == UINT64_MAX;
+    if (level && !is_high) high->push_back({t, UINT64_MAX});
+    if (!level && is_high) high->back().end = t;
+  }
+
+  // Intervals are sorted and non-overlapping.
+  static bool InInterval(const std::vector<Flash> &intervals, uint64_t t) {
+    auto found = std::upper_bound(
+        intervals.begin(), intervals.end(), t,
+        [](uint64_t t, const Flash &f) { return t < f.start; });
+    return found != intervals.begin() && t < (found - 1)->end;
+  }
+
+  static uint64_t NextChange(const std::vector<Flash> &intervals,
+                             uint64_t t) {
+    auto found = std::upper_bound(
+        intervals.begin(), intervals.end(), t,
+        [](uint64_t t, const Flash &f) { return t < f.end; });
+    if (found == intervals.end()) return UINT64_MAX;
+    return t < found->start ? found->start : found->end;
+  }
+
+  std::vector<Flash> presses_;
+  std::vector<Flash> channel_a_;  // Encoder line high phases.
+  std::vector<Flash> channel_b_;  // Same, quadrature channel.
+  std::vector<Tick> ticks_;
+  int quarter_ = 0;  // Tape position in quarter rows.
+  std::vector<Flash> flashes_;
+  std::vector<Latch> latches_;
+  struct Typed {
+    uint64_t time;
+    std::string text;
+  };
+  std::vector<Typed> typed_;  // Serial input, in time order.
+  size_t typed_pos_ = 0;
+  size_t char_pos_ = 0;
+  uint64_t end_ns_;
+
+  const std::vector<FrameBuffer::RowBits_t> stream_;  // Rows to stream.
+  const double feed_rate_;
+  std::vector<uint8_t> packet_;  // Encoded packet being sent.
+  size_t packet_pos_ = 0;
+  size_t packet_rows_ = 0;
+  uint8_t packet_type_ = 0;
+  size_t sent_ = 0;  // Rows acked.
+  uint8_t seq_ = 0;
+  bool awaiting_ack_ = false;
+  bool ended_ = false;
+  uint64_t next_packet_ns_ = 0;
+  int credit_ = 0;  // Unknown until the first ack.
+  int underruns_ = 0;
+  int min_queued_ = kStreamCapacity;  // While pulling.
+  std::vector<uint8_t> ack_;
+};
+
+struct PullStats {
+  int edges = 0;
+  int rows_expected = 0;
+  int rows_emitted = 0;
+  int warmup_edges = 0;  // Edges before first flash
+  int dropped = 0;       // Edges while printing that got no flash.
+  int halves = 0;        // Flashes halfway between edges.
+  int bad_halves = 0;    // Not the pixels lit in the rows either side.
+  int bunched = 0;       // Additional flashes within one edge interval.
+  int torn = 0;          // Rows latched while LEDs were on.
+  int cut = 0;           // Flashes still on when the next edge came.
+  double max_blur = 0;   // Largest fraction of a row moved during a flash.
+  int misplaced = 0;  // Flashed row not the one at its position or in order.
+  int missing = 0;    // Rows of the image never flashed; quadrature.
+  int underruns = 0;   // Stream rows needed before they arrived.
+  int min_queued = 0;  // Fewest stream rows queued while pulling.
+  double asleep = 0;   // Fraction of time the main loop slept.
+  double wake_us = 0;  // First edge to clock back at full speed.
+  double first_tick_us = 0;  // First edge to handled, as the firmware saw.
+  std::vector<double> latency_us;  // Negative if before the edge.
+
+  double LatencyPercentile(double p) const {
+    if (latency_us.empty()) return 0;
+    std::vector<double> sorted = latency_us;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+  }
+};
+
+// Rows as they go on the wire the firmware will emit for given content.
+std::vector<FrameBuffer::RowBits_t> ExpectedRows(int content) {
+  struct NullBoard : public sim::Board {
+    bool ReadPin(int, uint64_t) final { return false; }
+    void WritePin(int, bool, uint64_t) final {}
+    void SpiWrite(const uint8_t *, size_t, uint64_t, uint64_t) final {}
+  } null_board;
+  sim::Install(&null_board, {}, UINT64_MAX);
+  datetime_t t = {2024, 11, 2, 6, 12, 34, 56};
+  rtc_set_datetime(&t);
+  static FrameBuffer frame;
+  CreateContent(&frame, content);
+  frame.Finalize();  // Adds even/odd line offset rows.
+  std::vector<FrameBuffer::RowBits_t> rows(frame.size());
+  if (frame.display_list()) {  // Drawn while printing.
+    FrameBuffer::ListReader reader(frame.display_list());
+    for (int r = rows.size() - 1; r >= 0; --r) {
+      reader.Seek(r);
+      rows[r] = *reader.row();
+    }
+    return rows;
+  }
+  RowReader reader(frame.physical_rows());
+  for (int r = rows.size() - 1; r >= 0; --r) {
+    reader.Seek(r);
+    rows[r] = *reader.row();
+  }
+  return rows;
+}
+
+// Rows to stream: random, so that any row out of place shows.
+std::vector<FrameBuffer::RowBits_t> StreamRows(int count, unsigned seed) {
+  std::mt19937_64 rnd(seed);
+  std::vector<FrameBuffer::RowBits_t> rows(count);
+  for (auto &row : rows) {
+    for (int w = 0; w < kPanelCount; ++w) RowWord(row, w) = rnd();
+  }
+  return rows;
+}
+
+// Rows as they go on the wire for a stream without underruns.
+std::vector<FrameBuffer::RowBits_t> ExpectedStreamRows(
+    const std::vector<FrameBuffer::RowBits_t> &stream) {
+  FrameBuffer::RowStream_t queue;
+  FrameBuffer::StreamReader reader(&queue);
+  std::vector<FrameBuffer::RowBits_t> rows;
+  queue.Start();
+  for (size_t i = 0; /**/; ++i) {
+    if (i < stream.size()) queue.Push(stream[i]);
+    if (i == stream.size()) queue.End();
+    reader.Seek(INT_MAX - 1 - i);
+    if (reader.past_end()) return rows;
+    rows.push_back(*reader.row());
+  }
+}
+
+// Row latched when the flash started.
+const FrameBuffer::RowBits_t *FlashedRow(const PullBoard &board,
+                                         const Flash &f) {
+  const auto &latches = board.latches();
+  auto latch = std::upper_bound(
+      latches.begin(), latches.end(), f.start,
+      [](uint64_t t, const Latch &l) { return t < l.time; });
+  return latch == latches.begin() ? nullptr : &(latch - 1)->row;
+}
+
+// With a single channel, rows are flashed in order, one per edge: check
+// that each flash, other than half rows, shows the next one.
+void CheckOrder(const PullBoard &board,
+                const std::vector<FrameBuffer::RowBits_t> &rows,
+                const std::vector<bool> &half, PullStats *stats) {
+  const auto &flashes = board.flashes();
+  size_t next = 0;
+  for (size_t i = 0; i < flashes.size(); ++i) {
+    if (half[i]) continue;
+    const FrameBuffer::RowBits_t *row = FlashedRow(board, flashes[i]);
+    if (!row || next >= rows.size() || *row != rows[next]) ++stats->misplaced;
+    ++next;
+  }
+}
+
+// Half rows show the pixels lit in both the rows flashed before and after.
+void CheckHalfRows(const PullBoard &board, const std::vector<bool> &half,
+                   PullStats *stats) {
+  const auto &flashes = board.flashes();
+  for (size_t i = 0; i < flashes.size(); ++i) {
+    if (!half[i]) continue;
+    ++stats->halves;
+    const FrameBuffer::RowBits_t *row = FlashedRow(board, flashes[i]);
+    if (i == 0 || i + 1 == flashes.size() || half[i - 1] || half[i + 1] ||
+        !row) {
+      ++stats->bad_halves;
+      continue;
+    }
+    const FrameBuffer::RowBits_t *before = FlashedRow(board, flashes[i - 1]);
+    const FrameBuffer::RowBits_t *after = FlashedRow(board, flashes[i + 1]);
+    if (!before || !after || *row != (*before & *after)) ++stats->bad_halves;
+  }
+}
+
+// With quadrature, the image row at the given tape position: first tick is
+// position 1, the first image row kWarmupRows after. Rows are flashed last to
+// first. Outside the image if not in [0, rows).
+int ImageRow(int position, int rows) {
+  return rows - 1 - (position - 1 - kWarmupRows);
+}
+
+// With quadrature, the row flashed is given by the tape position: check that
+// each flash shows the row latched for its position.
+void CheckPositions(const PullBoard &board,
+                    const std::vector<FrameBuffer::RowBits_t> &rows,
+                    PullStats *stats) {
+  const auto &ticks = board.ticks();
+  const auto &latches = board.latches();
+  std::vector<bool> flashed(rows.size());
+  for (const Flash &f : board.flashes()) {
+    auto tick = std::upper_bound(
+        ticks.begin(), ticks.end(), f.start,
+        [](uint64_t t, const Tick &tick) { return t < tick.time; });
+    auto latch = std::upper_bound(
+        latches.begin(), latches.end(), f.start,
+        [](uint64_t t, const Latch &l) { return t < l.time; });
+    if (tick == ticks.begin() || latch == latches.begin()) {
+      ++stats->misplaced;
+      continue;
+    }
+    const int row = ImageRow((tick - 1)->position, rows.size());
+    if (row < 0 || row >= (int)rows.size() || (latch - 1)->row != rows[row]) {
+      ++stats->misplaced;
+    } else {
+      flashed[row] = true;
+    }
+  }
+  stats->missing = std::count(flashed.begin(), flashed.end(), false);
+}
+
+PullStats SimulatePull(const PullParams &params, const sim::CallCost &cost) {
+  PullStats stats;
+  const std::vector<FrameBuffer::RowBits_t> stream =
+      StreamRows(params.stream_rows, params.seed);
+  const std::vector<FrameBuffer::RowBits_t> rows =
+      params.stream_rows > 0 ? ExpectedStreamRows(stream)
+                             : ExpectedRows(params.button_presses);
+  const int gap_rows = (params.repeats - 1) * kRepeatGapRows;
+  stats.rows_expected = params.repeats * rows.size();
+  const int ticks = params.ticks > 0
+                        ? params.ticks
+                        : stats.rows_expected + gap_rows + 2 * kWarmupRows;
+  PullBoard board(params, ticks, stream);
+  sim::Install(&board, cost, board.end_ns());
+  datetime_t t = {2024, 11, 2, 6, 12, 34, 56};
+  rtc_set_datetime(&t);
+  try {
+    glowtape_main();
+  } catch (const sim::EndOfSimulation &) {
+  }
+
+  // Assign each row's flash to the nearest edge; flashes set up ahead may
+  // start before it. With half rows, those closer to halfway between are
+  // half rows. The exposures of a gray row are one flash of the row.
+  const auto &edges = board.ticks();
+  const auto &flashes = board.flashes();
+  std::vector<int> flashes_per_edge(edges.size());
+  std::vector<bool> half(flashes.size());
+  auto next_plane = [&](size_t i) {
+    if (i == 0 || flashes[i].start >= flashes[i - 1].end + kMaxPlaneGap) {
+      return false;
+    }
+    auto edge = std::upper_bound(
+        edges.begin(), edges.end(), flashes[i - 1].start,
+        [](uint64_t t, const Tick &e) { return t < e.time; });
+    return edge == edges.end() || edge->time > flashes[i].start;
+  };
+  int row_flashes = 0;
+  for (size_t i = 0; i < flashes.size(); ++i) {
+    if (next_plane(i)) continue;
+    Flash f = flashes[i];
+    for (size_t p = i + 1; p < flashes.size() && next_plane(p); ++p) {
+      f.end = flashes[p].end;
+    }
+    ++row_flashes;
+    auto it = std::upper_bound(
+        edges.begin(), edges.end(), f.start,
+        [](uint64_t t, const Tick &e) { return t < e.time; });
+    if (it == edges.begin()) continue;
+    --it;
+    if (it + 1 != edges.end()) {
+      const double fraction =
+          double(f.start - it->time) / ((it + 1)->time - it->time);
+      if (params.half_rows && fraction > 0.25 && fraction < 0.75) {
+        half[i] = true;
+        continue;
+      }
+      if (fraction >= 0.75) ++it;
+    }
+    ++flashes_per_edge[it - edges.begin()];
+    stats.latency_us.push_back((double(f.start) - it->time) / 1000.0);
+
+    const auto next = it + 1;
+    if (next == edges.end()) continue;
+    if (next->time < f.end) ++stats.cut;
+    const double blur = double(f.end - f.start) / (next->time - it->time);
+    stats.max_blur = std::max(stats.max_blur, blur);
+  }
+
+  for (const Latch &latch : board.latches()) {
+    for (const Flash &f : board.flashes()) {
+      if (latch.time > f.start && latch.time < f.end) ++stats.torn;
+    }
+  }
+  if (kQuadratureEncoder) CheckPositions(board, rows, &stats);
+  if (params.stream_rows > 0) {
+    CheckOrder(board, rows, half, &stats);
+    stats.underruns = board.underruns();
+    stats.min_queued = board.min_queued();
+  } else if (params.pause_ms > 0) {  // Image rows are flashed last to first.
+    CheckOrder(board, {rows.rbegin(), rows.rend()}, half, &stats);
+  }
+  CheckHalfRows(board, half, &stats);
+
+  stats.asleep = double(sim::AsleepNanos()) / sim::NowNanos();
+  const auto &raises = sim::ClockRaises();
+  if (!edges.empty()) {
+    auto raise = std::lower_bound(raises.begin(), raises.end(),
+                                  edges.front().time);
+    if (raise != raises.end()) {
+      stats.wake_us = (*raise - edges.front().time) / 1000.0;
+    }
+    stats.first_tick_us = idle_power.last_wake_usec();
+  }
+
+  stats.edges = edges.size();
+  stats.rows_emitted = row_flashes - stats.halves;
+  int first = -1, last = -1;
+  for (size_t i = 0; i < flashes_per_edge.size(); ++i) {
+    if (flashes_per_edge[i] == 0) continue;
+    if (first < 0) first = i;
+    last = i;
+    stats.bunched += flashes_per_edge[i] - 1;
+  }
+  stats.warmup_edges = first < 0 ? edges.size() : first;
+  for (int i = first; first >= 0 && i <= last; ++i) {
+    if (flashes_per_edge[i] > 0) continue;
+    const int row = ImageRow(edges[i].position, rows.size());
+    if (kQuadratureEncoder && (row < 0 || row >= (int)rows.size())) {
+      continue;  // Pulled back to before the image; nothing to flash.
+    }
+    ++stats.dropped;
+  }
+  if (first >= 0) stats.dropped -= std::min(stats.dropped, gap_rows);
+  return stats;
+}
+
+bool IsClean(const PullStats &s) {
+  if (s.dropped != 0 || s.bunched != 0 || s.torn != 0) return false;
+  if (s.bad_halves != 0) return false;
+  if (s.wake_us > kMaxWakeUsec || s.first_tick_us > kMaxWakeUsec) {
+    return false;
+  }
+  if (kQuadratureEncoder) {  // Rows pulled back are flashed again.
+    return s.misplaced == 0 && s.missing == 0;
+  }
+  return s.rows_emitted == s.rows_expected && s.misplaced == 0 &&
+         s.underruns == 0;
+}
+
+void PrintHeader(const PullParams &params) {
+  const bool stream = params.stream_rows > 0;
+  printf("%7s %6s %6s %6s %7s %7s %8s %5s %4s %6s %8s %8s %8s %7s %7s %7s",
+         "mm/s", "edges", "rows", "expect", "warmup", "dropped", "bunched",
+         "torn", "cut", "blur%", "lat-min", "lat-p50", "lat-p99", "asleep%",
+         "wake-us", "tick-us");
+  if (kQuadratureEncoder) printf(" %9s %7s", "misplaced", "missing");
+  if (stream) printf(" %9s %8s %9s", "misplaced", "underrun", "min-queue");
+  if (!stream && params.pause_ms > 0) printf(" %9s", "misplaced");
+  if (params.half_rows) printf(" %6s %8s", "halves", "bad-half");
+  printf("\n");
+}
+
+void PrintStats(const PullParams &params, const PullStats &s) {
+  const bool stream = params.stream_rows > 0;
+  printf("%7.1f %6d %6d %6d %7d %7d %8d %5d %4d %6.0f %8.1f %8.1f %8.1f "
+         "%7.1f %7.1f %7.1f",
+         params.speed, s.edges, s.rows_emitted, s.rows_expected, s.warmup_edges,
+         s.dropped, s.bunched, s.torn, s.cut, 100 * s.max_blur,
+         s.LatencyPercentile(0), s.LatencyPercentile(0.5),
+         s.LatencyPercentile(0.99), 100 * s.asleep, s.wake_us,
+         s.first_tick_us);
+  if (kQuadratureEncoder) printf(" %9d %7d", s.misplaced, s.missing);
+  if (stream) printf(" %9d %8d %9d", s.misplaced, s.underruns, s.min_queued);
+  if (!stream && params.pause_ms > 0) printf(" %9d", s.misplaced);
+  if (params.half_rows) printf(" %6d %8d", s.halves, s.bad_halves);
+  printf("\n");
+}
+
+int usage(const char *progname) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "Simulate pulling the tape through glowtape.\n"
+          "Options:\n"
+          "\t-p <profile>  : constant, accel or jitter (default: constant)\n"
+          "\t-s <mm/s>     : pull speed (default: 50)\n"
+          "\t-e <mm/s>     : end speed for accel profile\n"
+          "\t-j <fraction> : jitter std-deviation of tick interval (0.1)\n"
+          "\t-c <count>    : button presses, selecting content (default 0)\n"
+          "\t-n <ticks>    : encoder lines to pull (default: full image)\n"
+          "\t-x <factor>   : charge host compute time * factor (default 0)\n"
+          "\t-t <command>  : type serial command after the pull, e.g. stats\n"
+          "\t-b <rows>     : quadrature: pause halfway, pull back rows\n"
+          "\t-w <ms>       : single channel: pause halfway that long\n"
+          "\t-r <count>    : print content count times in one pull\n"
+          "\t-l <rows>     : stream that many rows from the host instead\n"
+          "\t-f <rows/s>   : rate the host has rows to stream (default: any)\n"
+          "\t-i            : interpolate half rows between rows (halfrows on)\n"
+          "\t-S            : sweep speeds; report max speed w/o lost rows\n",
+          progname);
+  return 1;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  PullParams params;
+  sim::CallCost cost;
+  bool sweep = false;
+  bool end_speed_given = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:s:e:j:c:n:x:t:b:w:r:l:f:iS")) != -1) {
+    switch (opt) {
+      case 'p':
+        if (strcmp(optarg, "constant") == 0) {
+          params.profile = Profile::kConstant;
+        } else if (strcmp(optarg, "accel") == 0) {
+          params.profile = Profile::kAccelerate;
+        } else if (strcmp(optarg, "jitter") == 0) {
+          params.profile = Profile::kJitter;
+        } else {
+          return usage(argv[0]);
+        }
+        break;
+      case 's': params.speed = atof(optarg); break;
+      case 'e':
+        params.end_speed = atof(optarg);
+        end_speed_given = true;
+        break;
+      case 'j': params.jitter = atof(optarg); break;
+      case 'c': params.button_presses = atoi(optarg); break;
+      case 'n': params.ticks = atoi(optarg); break;
+      case 'x': cost.cpu_scale = atof(optarg); break;
+      case 't': params.command = optarg; break;
+      case 'b': params.back_rows = atoi(optarg); break;
+      case 'w': params.pause_ms = atoi(optarg); break;
+      case 'r': params.repeats = atoi(optarg); break;
+      case 'l': params.stream_rows = atoi(optarg); break;
+      case 'f': params.feed_rate = atof(optarg); break;
+      case 'i': params.half_rows = true; break;
+      case 'S': sweep = true; break;
+      default: return usage(argv[0]);
+    }
+  }
+  if (!end_speed_given) params.end_speed = 3 * params.speed;
+  if (params.speed <= 0 || params.end_speed <= 0) return usage(argv[0]);
+  if (params.back_rows < 0 || (params.back_rows > 0 && !kQuadratureEncoder)) {
+    return usage(argv[0]);
+  }
+  if (params.pause_ms < 0 || (params.pause_ms > 0 && kQuadratureEncoder) ||
+      (params.pause_ms > 0 && params.repeats > 1)) {
+    return usage(argv[0]);
+  }
+  if (params.repeats < 1 || (params.repeats > 1 && kQuadratureEncoder)) {
+    return usage(argv[0]);
+  }
+  const bool stream = params.stream_rows > 0;
+  if (params.half_rows && kQuadratureEncoder) return usage(argv[0]);
+  if (params.stream_rows < 0 || (stream && kQuadratureEncoder) ||
+      (stream && params.repeats > 1) || params.feed_rate < 0) {
+    return usage(argv[0]);
+  }
+
+  PrintHeader(params);
+  if (!sweep) {
+    const PullStats stats = SimulatePull(params, cost);
+    PrintStats(params, stats);
+    return IsClean(stats) ? 0 : 2;
+  }
+
+  double max_clean_speed = 0;
+  for (double speed = 10; speed <= 300; speed += 10) {
+    params.speed = speed;
+    if (!end_speed_given) params.end_speed = 3 * speed;
+    const PullStats stats = SimulatePull(params, cost);
+    PrintStats(params, stats);
+    if (IsClean(stats) && max_clean_speed == speed - 10) {
+      max_clean_speed = speed;
+    }
+  }
+  printf("Max pull speed without lost or misplaced rows: %.0f mm/s\n",
+         max_clean_speed);
+  return 0;
+}
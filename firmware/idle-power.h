@@ -0,0 +1,87 @@
+#ifndef IDLE_POWER_H
+#define IDLE_POWER_H
+
+#include <cstdint>
+#include <cstdio>
+
+#include "hardware/clocks.h"
+#include "pico/time.h"
+
+// Between pulls the main loop has nothing to do but wait for the next
+// encoder edge. Instead of spinning, it sleeps until an interrupt: the
+// encoder edge, USB or the alarm that wakes it for the next poll of the
+// button and serial line. While idle, the system clock runs at 48MHz from
+// the USB PLL, with the system PLL off; the RTC and the timer run from the
+// crystal and are not affected.
+//
+// Dormant mode would save more, but it stops the crystal and the USB PLL:
+// the host loses the serial port and the RTC stops.
+//
+// Waking up to full speed takes the PLL relocking, well within the ticks
+// the encoder waits for before the first row is printed. The SDK switches
+// clk_peri along with clk_sys, so SPI and PIO dividers set at full speed
+// are off while idle; after Wake() returned true, they are to be set again
+// (FramePrinter::ClockChanged()).
+class IdlePower {
+  static constexpr uint32_t kRunClockKhz = 125'000;
+
+ public:
+  // Sleep until the next interrupt, at most max_usec. The first call after
+  // running drops the clock.
+  void Sleep(uint32_t max_usec) {
+    if (!idle_) {
+      set_sys_clock_48mhz();
+      idle_ = true;
+    }
+    Wait(max_usec);
+  }
+
+  // Wait for the next interrupt at the current clock, at most max_usec;
+  // between ticks while pulling. Waking up takes a few cycles.
+  void Wait(uint32_t max_usec) {
+    const absolute_time_t start = get_absolute_time();
+    best_effort_wfe_or_timeout(delayed_by_us(start, max_usec));
+    asleep_usec_ += absolute_time_diff_us(start, get_absolute_time());
+    ++sleeps_;
+  }
+
+  // Back to full clock, if idle before. Returns true if the clock changed.
+  bool Wake() {
+    if (!idle_) return false;
+    set_sys_clock_khz(kRunClockKhz, true);
+    idle_ = false;
+    ++wakes_;
+    return true;
+  }
+
+  // First encoder edge after idle has been taken care of at full clock: the
+  // wake-up latency.
+  void FirstTick(absolute_time_t edge_time) {
+    const int64_t usec = absolute_time_diff_us(edge_time, get_absolute_time());
+    last_wake_usec_ = usec;
+    if (usec > max_wake_usec_) max_wake_usec_ = usec;
+  }
+
+  // Wake-up latency of the latest pull.
+  int64_t last_wake_usec() const { return last_wake_usec_; }
+
+  void PrintStats() const {
+    const int64_t up_usec = to_us_since_boot(get_absolute_time());
+    printf("asleep: %lld of %lld ms (%d%%), %u sleeps, %u wakes\n",
+           (long long)(asleep_usec_ / 1000), (long long)(up_usec / 1000),
+           up_usec > 0 ? (int)(100 * asleep_usec_ / up_usec) : 0,
+           (unsigned)sleeps_, (unsigned)wakes_);
+    printf("wake to first tick: last %lld us, max %lld us\n",
+           (long long)last_wake_usec_, (long long)max_wake_usec_);
+  }
+
+ private:
+  bool idle_ = false;
+  int64_t asleep_usec_ = 0;
+  uint32_t sleeps_ = 0;
+  uint32_t wakes_ = 0;
+  int64_t last_wake_usec_ = 0;
+  int64_t max_wake_usec_ = 0;
+};
+
+#endif  // IDLE_POWER_H
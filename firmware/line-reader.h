@@ -19,9 +19,14 @@ class LineReader {
   void Poll() {
     const int maybe_char = getchar_timeout_us(0);
     if (maybe_char < 0) return;
-    putchar(maybe_char);  // echo
-    *pos_++ = (char)maybe_char;
-    const bool is_eol = (maybe_char == '\r' || maybe_char == '\n');
+    Feed(maybe_char);
+  }
+
+  // Process the next character if it was read elsewhere.
+  void Feed(char c) {
+    putchar(c);  // echo
+    *pos_++ = c;
+    const bool is_eol = (c == '\r' || c == '\n');
     if (is_eol || pos_ >= end_) {
       *(pos_ - 1) = '\0';  // Don't want newline; if buffer overflow: terminate.
       callback_(buf_);
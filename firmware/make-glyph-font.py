@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Generate a C++ header with font data from a BDF font, see glyph-font.h.
+
+Glyphs are emitted pre-rotated for both ScreenAspects, so that text can be
+drawn with one access per row of the tape instead of per pixel:
+  - scanlines (for kAlongWidth): one mask per pixel row of the glyph,
+    leftmost pixel in bit 63.
+  - columns (for kAlongLength): one mask per pixel column of the glyph,
+    topmost pixel in bit 0.
+Glyphs taller or wider than 64 pixels take multiple 64 bit words per
+scanline or column.
+
+Usage: make-glyph-font.py fonts/<name>.bdf <name> <name>.chars > font-<name>.h
+"""
+
+import sys
+
+
+def parse_bdf(filename):
+    """Returns ascent, descent and dict codepoint -> (dwidth, bbx, rows)."""
+    glyphs = {}
+    ascent = descent = 0
+    with open(filename, encoding="latin-1") as f:
+        lines = iter(f.read().splitlines())
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "FONT_ASCENT":
+            ascent = int(fields[1])
+        elif fields[0] == "FONT_DESCENT":
+            descent = int(fields[1])
+        elif fields[0] == "ENCODING":
+            codepoint = int(fields[1])
+        elif fields[0] == "DWIDTH":
+            dwidth = int(fields[1])
+        elif fields[0] == "BBX":
+            bbx = [int(v) for v in fields[1:5]]
+        elif fields[0] == "BITMAP":
+            rows = []
+            for _ in range(bbx[1]):
+                hex_row = next(lines).strip()
+                rows.append((int(hex_row, 16), 4 * len(hex_row)))
+            glyphs[codepoint] = (dwidth, bbx, rows)
+    return ascent, descent, glyphs
+
+
+def glyph_pixels(ascent, height, dwidth, bbx, rows):
+    """Set pixels (x, y) of glyph; y = 0 is the top of the font."""
+    w, h, xoff, yoff = bbx
+    pixels = set()
+    for r, (bits, nbits) in enumerate(rows):
+        y = ascent - (yoff + h) + r
+        for c in range(w):
+            x = xoff + c
+            if (bits >> (nbits - 1 - c)) & 1 and 0 <= x < dwidth \
+                    and 0 <= y < height:
+                pixels.add((x, y))
+    return pixels
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit(__doc__)
+    bdf, name, chars_file = sys.argv[1:]
+    ascent, descent, font = parse_bdf(bdf)
+    height = ascent + descent
+    with open(chars_file, encoding="utf-8") as f:
+        chars = sorted(set(ord(c) for c in f.read() if c != "\n"))
+    chars = [c for c in chars if c in font]
+    max_width = max(font[c][0] for c in chars)
+    words_per_scanline = (max_width + 63) // 64
+    words_per_column = (height + 63) // 64
+
+    bits = []
+    glyphs = []
+    for codepoint in chars:
+        dwidth, bbx, rows = font[codepoint]
+        pixels = glyph_pixels(ascent, height, dwidth, bbx, rows)
+        scanlines = len(bits)
+        for y in range(height):
+            for word in range(words_per_scanline):
+                mask = 0
+                for i in range(64):
+                    if (64 * word + i, y) in pixels:
+                        mask |= 1 << (63 - i)
+                bits.append(mask)
+        columns = len(bits)
+        for x in range(dwidth):
+            for word in range(words_per_column):
+                mask = 0
+                for i in range(64):
+                    if (x, 64 * word + i) in pixels:
+                        mask |= 1 << i
+                bits.append(mask)
+        glyphs.append((codepoint, dwidth, scanlines, columns))
+
+    ident = name.replace("-", "_")
+    guard = "FONT_%s_H" % ident.upper()
+    out = sys.stdout
+    out.write("// Generated by make-glyph-font.py from %s; do not edit.\n" % bdf)
+    out.write("#ifndef %s\n#define %s\n\n" % (guard, guard))
+    out.write('#include "glyph-font.h"\n\n')
+    out.write("static constexpr uint64_t kBits_%s[] = {\n" % ident)
+    for i in range(0, len(bits), 4):
+        out.write("  %s,\n" % ", ".join("0x%016x" % b for b in bits[i:i + 4]))
+    out.write("};\n\n")
+    out.write("static constexpr Glyph kGlyphs_%s[] = {\n" % ident)
+    for codepoint, dwidth, scanlines, columns in glyphs:
+        out.write("  {%d, %d, %d, %d},  // %r\n" %
+                  (codepoint, dwidth, scanlines, columns, chr(codepoint)))
+    out.write("};\n\n")
+    out.write("static constexpr GlyphFont font_%s = {\n" % ident)
+    out.write("  %d, %d, %d, %d, kGlyphs_%s, kBits_%s,\n" %
+              (height, words_per_scanline, words_per_column, len(glyphs),
+               ident, ident))
+    out.write("};\n\n#endif  // %s\n" % guard)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,211 @@
+#ifndef PACKET_READER_H
+#define PACKET_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "pico/stdlib.h"
+
+// Binary packets on the serial line, next to the text commands read by
+// LineReader. Text never contains a zero byte, so packets are COBS encoded
+// and framed by zero bytes on both ends:
+//   0x00 <COBS(type, seq, data..., crc16 high, crc16 low)> 0x00
+// The CRC is CRC-16/CCITT-FALSE over type, seq and data. Packets are not
+// echoed; each one that arrives complete is answered with an ack packet
+//   0x00 <COBS('A', seq, status, data..., crc16)> 0x00
+// with the status returned by the packet processor (kBadPacket if the CRC
+// did not match). See upload-image.py for the host side.
+//
+// A zero byte alone does not make a packet: the bytes after it are held
+// until the next zero and only taken as a packet if they decode to one with
+// the right CRC. Otherwise, if they are text, e.g. a command typed after a
+// stray zero, they go to the text path after all. Packets arrive in one go,
+// so bytes held when the line falls silent for kResyncUsec are no packet
+// either.
+//
+// Acks are queued and sent with SendAck(), which does not wait for them to
+// go out.
+template <size_t kMaxPayload>
+class PacketReader {
+  // Largest encoded packet: payload plus type, seq, CRC and COBS overhead.
+  static constexpr size_t kMaxPacket = kMaxPayload + 6 + kMaxPayload / 254;
+  static constexpr uint32_t kResyncUsec = 50'000;
+
+  struct CrcTable {
+    uint16_t entry[256];
+  };
+  static constexpr CrcTable MakeCrcTable() {
+    CrcTable result{};
+    for (int i = 0; i < 256; ++i) {
+      uint16_t crc = i << 8;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+      }
+      result.entry[i] = crc;
+    }
+    return result;
+  }
+
+ public:
+  enum Status : uint8_t {
+    kOk = 0,
+    kBadPacket = 1,  // CRC mismatch or too long. Host should resend.
+    kUnknownType = 2,
+    kOutOfSpace = 3,
+    kOutOfOrder = 4,
+    kBusy = 5,  // Try again later.
+    kNotFound = 6,
+  };
+
+  // Called with a verified packet. Returns status for the ack and can set
+  // up to kMaxReplySize bytes of reply data.
+  static constexpr size_t kMaxReplySize = 8;
+  using PacketProcessor = std::function<Status(
+      uint8_t type, uint8_t seq, const uint8_t *data, size_t len,
+      uint8_t *reply, size_t *reply_len)>;
+  // Gets the bytes that are not part of a packet.
+  using TextProcessor = std::function<void(char c)>;
+
+  PacketReader(const PacketProcessor &packet_processor,
+               const TextProcessor &text_processor)
+      : callback_(packet_processor), text_(text_processor) {}
+
+  // Feed the next byte from the serial line.
+  void Feed(uint8_t c) {
+    last_byte_ = get_absolute_time();
+    if (c == 0) {
+      // A frame ends; the zero also starts the next one, unless the frame
+      // was a packet: then a zero comes first again.
+      const bool packet = in_packet_ && len_ > 0 && ProcessPacket();
+      in_packet_ = !packet;
+      len_ = 0;
+      overflow_ = false;
+      return;
+    }
+    if (!in_packet_) {
+      text_(c);
+      return;
+    }
+    if (len_ < sizeof(buf_)) {
+      buf_[len_++] = c;
+    } else {
+      overflow_ = true;
+    }
+  }
+
+  // Nothing to read right now. Bytes held too long are not a packet.
+  void Idle() {
+    if (!in_packet_ ||
+        absolute_time_diff_us(last_byte_, get_absolute_time()) < kResyncUsec) {
+      return;
+    }
+    if (!overflow_ && IsText()) {
+      for (size_t i = 0; i < len_; ++i) text_(buf_[i]);
+    }
+    in_packet_ = false;
+    len_ = 0;
+    overflow_ = false;
+  }
+
+  // Hand the queued ack to stdio. Not flushed: USB sends it on its own, and
+  // meanwhile the other tasks run.
+  void SendAck() {
+    for (size_t i = 0; i < ack_len_; ++i) putchar_raw(ack_[i]);
+    ack_len_ = 0;
+  }
+
+  // CRC-16/CCITT-FALSE.
+  static uint16_t Crc16(const uint8_t *data, size_t len,
+                        uint16_t crc = 0xffff) {
+    static constexpr CrcTable kTable = MakeCrcTable();
+    for (size_t i = 0; i < len; ++i) {
+      crc = (crc << 8) ^ kTable.entry[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+  }
+
+ private:
+  // Decode COBS into packet_, keeping the frame in case it is text; returns
+  // decoded length.
+  size_t CobsDecode() {
+    size_t out = 0;
+    for (size_t in = 0; in < len_; /**/) {
+      const uint8_t code = buf_[in++];
+      for (uint8_t i = 1; i < code && in < len_; ++i) {
+        packet_[out++] = buf_[in++];
+      }
+      if (code != 0xff && in < len_) packet_[out++] = 0;
+    }
+    return out;
+  }
+
+  // Printable characters and line ends only, as typed.
+  bool IsText() const {
+    for (size_t i = 0; i < len_; ++i) {
+      const uint8_t c = buf_[i];
+      if ((c < ' ' || c > '~') && c != '\r' && c != '\n' && c != '\t') {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns false if the frame held is not a packet; text in it then goes
+  // to the text path. A damaged packet is acked with kBadPacket.
+  bool ProcessPacket() {
+    const size_t len = overflow_ ? 0 : CobsDecode();
+    if (len < 4 || Crc16(packet_, len - 2) !=
+                       (packet_[len - 2] << 8 | packet_[len - 1])) {
+      if (!overflow_ && IsText()) {
+        for (size_t i = 0; i < len_; ++i) text_(buf_[i]);
+        return false;
+      }
+      QueueAck(len >= 2 ? packet_[1] : 0, kBadPacket, nullptr, 0);
+      return true;
+    }
+    uint8_t reply[kMaxReplySize];
+    size_t reply_len = 0;
+    const Status status = callback_(packet_[0], packet_[1], packet_ + 2,
+                                    len - 4, reply, &reply_len);
+    QueueAck(packet_[1], status, reply, reply_len);
+    return true;
+  }
+
+  void QueueAck(uint8_t seq, Status status, const uint8_t *data,
+                size_t len) {
+    uint8_t packet[3 + kMaxReplySize + 2] = {'A', seq, status};
+    for (size_t i = 0; i < len; ++i) packet[3 + i] = data[i];
+    len += 3;
+    const uint16_t crc = Crc16(packet, len);
+    packet[len++] = crc >> 8;
+    packet[len++] = crc & 0xff;
+
+    // COBS encoded, sent raw so that no newline translation happens. An ack
+    // not sent yet is replaced: the host only waits for the latest.
+    ack_len_ = 0;
+    ack_[ack_len_++] = 0;
+    size_t block_start = 0;
+    for (size_t i = 0; i <= len; ++i) {
+      if (i == len || packet[i] == 0) {
+        ack_[ack_len_++] = i - block_start + 1;
+        for (size_t j = block_start; j < i; ++j) ack_[ack_len_++] = packet[j];
+        block_start = i + 1;
+      }
+    }
+    ack_[ack_len_++] = 0;
+  }
+
+  uint8_t buf_[kMaxPacket];  // As received.
+  uint8_t packet_[kMaxPacket];  // Decoded.
+  size_t len_ = 0;
+  bool in_packet_ = false;
+  bool overflow_ = false;
+  absolute_time_t last_byte_ = {};
+  uint8_t ack_[3 + kMaxReplySize + 2 + 3];  // Zeros and COBS codes added.
+  size_t ack_len_ = 0;
+  PacketProcessor callback_;
+  TextProcessor text_;
+};
+
+#endif  // PACKET_READER_H
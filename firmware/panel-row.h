@@ -0,0 +1,131 @@
+#ifndef PANEL_ROW_H
+#define PANEL_ROW_H
+
+#include <cstdint>
+#include <type_traits>
+
+// Glowxels boards chained side by side, 64 pixels each, for wider tape.
+// Build with -DGLOWTAPE_PANELS=2 or 4 for 128 or 256 pixels. Frames take RAM
+// in proportion; more than four don't fit (see glowtape.cc).
+#ifndef GLOWTAPE_PANELS
+#define GLOWTAPE_PANELS 1
+#endif
+constexpr int kPanelCount = GLOWTAPE_PANELS;
+static_assert(kPanelCount >= 1 && kPanelCount <= 4, "Up to four panels");
+
+// Build with -DGLOWTAPE_PIO_LANES=n to shift rows out by PIO on n data lanes
+// at once instead of by SPI, each lane a chain of kPanelCount / n panels
+// (see row-output.h). Rows are stored with the bits of the lanes interleaved.
+#ifndef GLOWTAPE_PIO_LANES
+#define GLOWTAPE_PIO_LANES 0
+#endif
+constexpr int kOutputLanes = GLOWTAPE_PIO_LANES > 0 ? GLOWTAPE_PIO_LANES : 1;
+static_assert((kOutputLanes & (kOutputLanes - 1)) == 0 &&
+                  kPanelCount % kOutputLanes == 0,
+              "Lanes: a power of two, each with the same number of panels");
+
+// A row across several panels: one 64 bit word per panel, leftmost pixel in
+// bit 63 of word 0, pixel 64 in bit 63 of word 1 and so on. Operations go
+// word by word.
+template <int kPanels>
+struct PanelRow {
+  uint64_t words[kPanels] = {};
+
+  constexpr PanelRow &operator|=(const PanelRow &other) {
+    for (int w = 0; w < kPanels; ++w) words[w] |= other.words[w];
+    return *this;
+  }
+  constexpr PanelRow &operator&=(const PanelRow &other) {
+    for (int w = 0; w < kPanels; ++w) words[w] &= other.words[w];
+    return *this;
+  }
+  constexpr PanelRow &operator^=(const PanelRow &other) {
+    for (int w = 0; w < kPanels; ++w) words[w] ^= other.words[w];
+    return *this;
+  }
+  constexpr PanelRow operator~() const {
+    PanelRow result;
+    for (int w = 0; w < kPanels; ++w) result.words[w] = ~words[w];
+    return result;
+  }
+  friend constexpr PanelRow operator|(PanelRow a, const PanelRow &b) {
+    return a |= b;
+  }
+  friend constexpr PanelRow operator&(PanelRow a, const PanelRow &b) {
+    return a &= b;
+  }
+  friend constexpr PanelRow operator^(PanelRow a, const PanelRow &b) {
+    return a ^= b;
+  }
+  friend constexpr bool operator==(const PanelRow &a, const PanelRow &b) {
+    for (int w = 0; w < kPanels; ++w) {
+      if (a.words[w] != b.words[w]) return false;
+    }
+    return true;
+  }
+  friend constexpr bool operator!=(const PanelRow &a, const PanelRow &b) {
+    return !(a == b);
+  }
+};
+
+// Row type for the given number of panels; a plain word for a single one.
+template <int kPanels>
+using RowBitsFor =
+    std::conditional_t<kPanels == 1, uint64_t, PanelRow<kPanels>>;
+
+// Words of a row, the same way for both kinds of rows.
+template <typename Row>
+constexpr int kRowWords = sizeof(Row) / sizeof(uint64_t);
+
+template <typename Row>
+constexpr int kRowColumns = 64 * kRowWords<Row>;
+
+constexpr uint64_t &RowWord(uint64_t &row, int) { return row; }
+constexpr uint64_t RowWord(const uint64_t &row, int) { return row; }
+template <int kPanels>
+constexpr uint64_t &RowWord(PanelRow<kPanels> &row, int w) {
+  return row.words[w];
+}
+template <int kPanels>
+constexpr uint64_t RowWord(const PanelRow<kPanels> &row, int w) {
+  return row.words[w];
+}
+
+// Row with the 64 pixels of chunk, leftmost in bit 63, starting at the given
+// column; pixels beyond either end of the row are dropped.
+template <typename Row>
+constexpr Row PlaceColumns(uint64_t chunk, int column) {
+  Row row{};
+  for (int w = 0; w < kRowWords<Row>; ++w) {
+    const int shift = column - 64 * w;  // Right shift into this word.
+    if (shift <= -64 || shift >= 64) continue;
+    RowWord(row, w) |= shift >= 0 ? chunk >> shift : chunk << -shift;
+  }
+  return row;
+}
+
+enum class ScreenAspect {
+  kAlongWidth,   // X axis along width; (0, 0) at top left after full pull.
+  kAlongLength,  // X axis along length; (0, 0) first in pull, at top.
+};
+
+// Row and columns of up to 64 pixels that lie along one row: for kAlongWidth
+// pixels (x + i, y) for bit 63 - i, for kAlongLength pixels (x, y + i) for
+// bit i. Bits are placed in their columns. Returns false if none of the 64
+// pixel positions is on the tape.
+template <typename Row>
+constexpr bool AlongRow(ScreenAspect aspect, int x, int y, uint64_t bits,
+                        int *row, Row *placed) {
+  constexpr int kColumns = kRowColumns<Row>;
+  *row = y;
+  int column = x;  // Of bit 63.
+  if (aspect == ScreenAspect::kAlongLength) {
+    *row = x;
+    column = kColumns - 63 - y;  // Column of (x, y) is kColumns - y.
+  }
+  if (column <= -64 || column >= kColumns) return false;
+  *placed = PlaceColumns<Row>(bits, column);
+  return true;
+}
+
+#endif  // PANEL_ROW_H
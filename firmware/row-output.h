@@ -0,0 +1,193 @@
+#ifndef ROW_OUTPUT_H
+#define ROW_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/spi.h"
+#include "panel-row.h"
+
+// Shifting rows out to the Glowxels shift registers, by DMA in the
+// background. Send() starts a row, WaitLatched() returns once it is latched;
+// only one row is in flight at a time. The bit clock is divided down from
+// the system clock; ClockChanged() sets it again after that changed.
+//
+// Data, clock and latch are on consecutive pins: the latch two below the
+// data pin, the clock right below.
+
+// All panels in one chain on SPI; the chip select latches the row once the
+// last bit is out. Shifting out takes longer with each panel.
+class SpiRowOutput {
+  static constexpr uint kBitClockHz = 1'000'000;
+
+ public:
+  // Time to shift out a row of the given size.
+  static constexpr uint32_t ShiftUsec(size_t bytes) {
+    return bytes * 8'000'000 / kBitClockHz;
+  }
+
+  SpiRowOutput(int spiTxPin, spi_inst_t *instance) : instance_(instance) {
+    spi_init(instance_, kBitClockHz);
+    spi_set_format(instance_, 8,            // Regylar 8 bits transfer
+                   spi_cpol_t::SPI_CPOL_1,  // pos polarity
+                   spi_cpha_t::SPI_CPHA_1,  // phase
+                   spi_order_t::SPI_MSB_FIRST);
+    // Luckily, the RP2040 has pin-muxing pretty standardized and we can derive
+    // the remaining pins from just knowing one pin.
+    const int spiSckPin = spiTxPin - 1;
+    const int spiCsPin = spiTxPin - 2;  // Also called 'latch' on glowxels
+    gpio_set_function(spiTxPin, GPIO_FUNC_SPI);
+    gpio_set_function(spiSckPin, GPIO_FUNC_SPI);
+    gpio_set_function(spiCsPin, GPIO_FUNC_SPI);
+
+    // Bytes go straight to the SPI data register, paced by its TX FIFO.
+    dma_channel_ = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(dma_channel_);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, spi_get_dreq(instance_, true));
+    dma_channel_configure(dma_channel_, &config, &spi_get_hw(instance_)->dr,
+                          nullptr, 0, false);
+  }
+
+  // SPI runs from clk_peri, which the SDK switches along with clk_sys.
+  void ClockChanged() { spi_set_baudrate(instance_, kBitClockHz); }
+
+  void Send(const void *row, size_t bytes) {
+    dma_channel_transfer_from_buffer_now(dma_channel_, row, bytes);
+  }
+
+  // The row is latched in the shift registers when DMA fed all bytes to the
+  // FIFO and SPI is done shifting them out.
+  void WaitLatched() {
+    dma_channel_wait_for_finish_blocking(dma_channel_);
+    while (spi_is_busy(instance_)) {
+    }
+  }
+
+ private:
+  spi_inst_t *const instance_;
+  uint dma_channel_;
+};
+
+// Panels on kLanes chains side by side, shifted out at the same time by a
+// PIO state machine: a data pin for each lane from the given one up, one
+// clock and latch for all. A row takes as long as the bits of one lane, so
+// adding lanes for more panels keeps the time the same.
+//
+// Rows are stored with the bits of the lanes interleaved (see
+// FrameBuffer::WireRow()), so DMA feeds them to the state machine as they
+// are; it takes kLanes bits for each clock. The state machine flags each
+// latched row with its PIO interrupt flag.
+//
+// As with SPI, each row is a DMA transfer of its own, started by Send():
+// rows go out when the tape reaches them, not at a steady rate, so there is
+// no ring of rows for DMA to run through by itself.
+template <int kPanels, int kLanes>
+class PioRowOutput {
+  static constexpr uint kBitClockHz = 1'000'000;
+  static constexpr uint kBitsPerLane = 64 * kPanels / kLanes;
+  static_assert(32 % kLanes == 0, "Whole clocks per FIFO word");
+
+  // Side-set pins: latch, clock.
+  static constexpr uint kSideSetBits = 2;
+  static constexpr uint kLatch = 0b01;
+  static constexpr uint kClock = 0b10;
+
+  // Two instructions per bit.
+  static float ClockDivider() {
+    return clock_get_hz(clk_sys) / (2.0f * kBitClockHz);
+  }
+
+ public:
+  static constexpr uint32_t ShiftUsec(size_t bytes) {
+    return bytes * 8'000'000 / kLanes / kBitClockHz;
+  }
+
+  PioRowOutput(int first_data_pin, PIO pio) : pio_(pio) {
+    const int latch_pin = first_data_pin - 2;  // Clock in between.
+    // Bits are set with the clock low and taken on the rising edge, as with
+    // SPI mode 3. The loop counter x starts at kBitsPerLane - 1, kept in y.
+    const uint16_t instructions[] = {
+        // 0: Next bit of each lane; waits for data between rows.
+        static_cast<uint16_t>(pio_encode_out(pio_pins, kLanes) |
+                              pio_encode_sideset(kSideSetBits, 0)),
+        // 1: Shift registers take it.
+        static_cast<uint16_t>(pio_encode_jmp_x_dec(0) |
+                              pio_encode_sideset(kSideSetBits, kClock)),
+        // 2: Latch the row; count again.
+        static_cast<uint16_t>(pio_encode_mov(pio_x, pio_y) |
+                              pio_encode_sideset(kSideSetBits, kLatch)),
+        // 3: Tell WaitLatched().
+        static_cast<uint16_t>(pio_encode_irq_set(true, 0) |
+                              pio_encode_sideset(kSideSetBits, 0)),
+    };
+    const pio_program_t program = {instructions, 4, -1};
+    const uint offset = pio_add_program(pio_, &program);
+    sm_ = pio_claim_unused_sm(pio_, true);
+
+    pio_sm_config config = pio_get_default_sm_config();
+    sm_config_set_wrap(&config, offset, offset + 3);
+    sm_config_set_out_pins(&config, first_data_pin, kLanes);
+    sm_config_set_sideset(&config, kSideSetBits, false, false);
+    sm_config_set_sideset_pins(&config, latch_pin);
+    sm_config_set_out_shift(&config, false, true, 32);  // MSB first, autopull
+    sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_TX);
+    sm_config_set_clkdiv(&config, ClockDivider());
+    for (int pin = latch_pin; pin < first_data_pin + kLanes; ++pin) {
+      pio_gpio_init(pio_, pin);
+    }
+    pio_sm_set_consecutive_pindirs(pio_, sm_, latch_pin, kLanes + 2, true);
+    pio_sm_init(pio_, sm_, offset, &config);
+
+    pio_sm_put(pio_, sm_, kBitsPerLane - 1);
+    pio_sm_exec(pio_, sm_, pio_encode_pull(false, true));
+    pio_sm_exec(pio_, sm_, pio_encode_out(pio_y, 32));
+    pio_sm_exec(pio_, sm_, pio_encode_mov(pio_x, pio_y));
+    pio_sm_exec(pio_, sm_, pio_encode_irq_set(true, 0));  // None in flight.
+    pio_sm_set_enabled(pio_, sm_, true);
+
+    // Words to the TX FIFO, byte swapped: bits go out in memory order.
+    dma_channel_ = dma_claim_unused_channel(true);
+    dma_channel_config dma = dma_channel_get_default_config(dma_channel_);
+    channel_config_set_transfer_data_size(&dma, DMA_SIZE_32);
+    channel_config_set_read_increment(&dma, true);
+    channel_config_set_write_increment(&dma, false);
+    channel_config_set_bswap(&dma, true);
+    channel_config_set_dreq(&dma, pio_get_dreq(pio_, sm_, true));
+    dma_channel_configure(dma_channel_, &dma, &pio_->txf[sm_], nullptr, 0,
+                          false);
+  }
+
+  void ClockChanged() { pio_sm_set_clkdiv(pio_, sm_, ClockDivider()); }
+
+  void Send(const void *row, size_t bytes) {
+    pio_interrupt_clear(pio_, sm_);
+    dma_channel_transfer_from_buffer_now(dma_channel_, row, bytes / 4);
+  }
+
+  void WaitLatched() {
+    dma_channel_wait_for_finish_blocking(dma_channel_);
+    while (!pio_interrupt_get(pio_, sm_)) {
+    }
+  }
+
+ private:
+  const PIO pio_;
+  uint sm_;
+  uint dma_channel_;
+};
+
+// Output the firmware is built for.
+#if GLOWTAPE_PIO_LANES
+using RowOutput = PioRowOutput<kPanelCount, kOutputLanes>;
+#else
+using RowOutput = SpiRowOutput;
+#endif
+
+#endif  // ROW_OUTPUT_H
@@ -0,0 +1,207 @@
+#ifndef ROW_STORE_H
+#define ROW_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "panel-row.h"
+
+// Compressed storage of rows as they go out on the wire.
+//
+// Most images are largely blank or have long runs of the same row, and
+// neighboring rows of text or graphics only differ in a few bytes. So each
+// row is stored as the difference to the row before: either a run of
+// identical rows or the bytes that changed.
+//
+// Rows are printed last to first, so the data is read backwards from the
+// end. Each record ends in a tag byte:
+//   tag != 0 : bit i set if byte i of the row changed. The changed bytes,
+//              XOR'ed with the previous row, precede the tag; lowest first.
+//   tag == 0 : the byte before is the count (1..255) of rows identical to
+//              the previous one.
+// Reading a row touches at most nine bytes, so the cost per row is bounded.
+//
+// Rows wider than one panel (see panel-row.h) are encoded word by word: a
+// changed row ends in a byte with bit w set if word w changed, preceded by
+// the records of these words as above, lowest word first. Runs are the same.
+// The bytes read per row are bounded by nine per panel.
+
+// Encoded rows; points to a RowEncoder in RAM or constexpr data in flash.
+template <typename Row>
+struct BasicRowData {
+  const uint8_t *bytes = nullptr;
+  size_t size = 0;
+  int rows = 0;
+  Row last_row{};  // Reading starts here.
+};
+using RowData = BasicRowData<RowBitsFor<kPanelCount>>;
+
+// Appends rows to a fixed size buffer. Can be used in constexpr context to
+// prepare static content at compile time. With kMaxBytes = 0, it only
+// counts the bytes needed.
+template <size_t kMaxBytes, typename Row = RowBitsFor<kPanelCount>>
+class RowEncoder {
+  static constexpr int kWords = kRowWords<Row>;
+
+ public:
+  constexpr void Clear() {
+    size_ = 0;
+    rows_ = 0;
+    last_row_ = Row{};
+    repeat_ = 0;
+  }
+
+  // Append row. Returns false if it does not fit anymore.
+  constexpr bool Append(const Row &row) {
+    const Row delta = row ^ last_row_;
+    const bool same = (delta == Row{});
+    if (same && repeat_ > 0 && repeat_ < 255) {  // Extend run.
+      ++repeat_;
+      if (kMaxBytes > 0) bytes_[size_ - 2] = repeat_;
+      ++rows_;
+      return true;
+    }
+
+    uint8_t record[9 * kWords + 1] = {};
+    size_t len = 0;
+    if (same) {
+      record[len++] = 1;  // Start new run.
+      record[len++] = 0;
+    } else {
+      uint8_t changed_words = 0;
+      for (int w = 0; w < kWords; ++w) {
+        const uint64_t word = RowWord(delta, w);
+        if (!word) continue;
+        uint8_t tag = 0;
+        for (int i = 0; i < 8; ++i) {
+          const uint8_t changed = word >> (8 * i);
+          if (!changed) continue;
+          record[len++] = changed;
+          tag |= 1 << i;
+        }
+        record[len++] = tag;
+        changed_words |= 1 << w;
+      }
+      if (kWords > 1) record[len++] = changed_words;
+    }
+    if (kMaxBytes > 0) {
+      if (size_ + len > kMaxBytes) return false;
+      for (size_t i = 0; i < len; ++i) bytes_[size_ + i] = record[i];
+    }
+    size_ += len;
+    repeat_ = same ? 1 : 0;
+    last_row_ = row;
+    ++rows_;
+    return true;
+  }
+
+  constexpr BasicRowData<Row> data() const {
+    return {bytes_, size_, rows_, last_row_};
+  }
+  constexpr size_t size() const { return size_; }
+  constexpr int rows() const { return rows_; }
+
+ private:
+  uint8_t bytes_[kMaxBytes > 0 ? kMaxBytes : 1] = {};
+  size_t size_ = 0;
+  int rows_ = 0;
+  Row last_row_{};
+  uint8_t repeat_ = 0;  // Length of run at the end; 0 if none.
+};
+
+// Reads rows back, starting with the last one. Stepping to the row before
+// is cheap; to go back to a later row, e.g. when the tape is pulled back,
+// Seek() restarts from a checkpoint saved every kCheckpointStride rows on
+// the way, or from the end if it is too far back.
+template <typename Row>
+class BasicRowReader {
+  static constexpr int kCheckpointStride = 32;  // Power of two.
+  static constexpr int kCheckpoints = 16;
+  static constexpr int kWords = kRowWords<Row>;
+
+ public:
+  BasicRowReader() = default;
+  explicit BasicRowReader(const BasicRowData<Row> &data) : data_(data) {
+    Restart();
+  }
+
+  // Index of the current row; -1 if there are no more.
+  int index() const { return index_; }
+
+  // Current row. The address stays the same, so it can be handed to DMA.
+  const Row *row() const { return &row_; }
+
+  // Step to the row before.
+  void Prev() {
+    if (index_ < 0) return;
+    --index_;
+    if (repeat_left_ > 0) {
+      --repeat_left_;
+    } else {
+      const uint8_t tag = *--end_;
+      if (tag == 0) {
+        repeat_left_ = *--end_ - 1;
+      } else if (kWords == 1) {
+        ApplyWord(0, tag);
+      } else {  // Tag has the changed words.
+        for (int w = kWords - 1; w >= 0; --w) {
+          if (tag & (1 << w)) ApplyWord(w, *--end_);
+        }
+      }
+    }
+    if ((index_ & (kCheckpointStride - 1)) == 0 && index_ >= 0) {
+      checkpoints_[(index_ / kCheckpointStride) % kCheckpoints] = {
+          end_, index_, repeat_left_, row_};
+    }
+  }
+
+  // Go to the given row, 0 <= row < rows.
+  void Seek(int row) {
+    if (row > index_) {
+      const int later = (row + kCheckpointStride - 1) & ~(kCheckpointStride - 1);
+      const Checkpoint &c = checkpoints_[(later / kCheckpointStride) %
+                                         kCheckpoints];
+      if (c.index == later && later < data_.rows) {
+        end_ = c.end;
+        index_ = c.index;
+        repeat_left_ = c.repeat_left;
+        row_ = c.row;
+      } else {
+        Restart();
+      }
+    }
+    while (index_ > row) Prev();
+  }
+
+ private:
+  struct Checkpoint {
+    const uint8_t *end = nullptr;
+    int index = -1;
+    uint8_t repeat_left = 0;
+    Row row{};
+  };
+
+  // XOR the changed bytes given by tag into word w of the row.
+  void ApplyWord(int w, uint8_t tag) {
+    uint64_t &word = RowWord(row_, w);
+    for (int i = 7; i >= 0; --i) {
+      if (tag & (1 << i)) word ^= static_cast<uint64_t>(*--end_) << (8 * i);
+    }
+  }
+
+  void Restart() {
+    end_ = data_.bytes + data_.size;
+    index_ = data_.rows - 1;
+    repeat_left_ = 0;
+    row_ = data_.last_row;
+  }
+
+  BasicRowData<Row> data_;
+  const uint8_t *end_ = nullptr;  // Records before this not read yet.
+  int index_ = -1;
+  uint8_t repeat_left_ = 0;
+  Row row_{};
+  Checkpoint checkpoints_[kCheckpoints];
+};
+using RowReader = BasicRowReader<RowBitsFor<kPanelCount>>;
+#endif
@@ -0,0 +1,107 @@
+#ifndef ROW_STREAM_H
+#define ROW_STREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "panel-row.h"
+
+// Rows arriving while the tape is pulled, e.g. a ticker fed over USB, to be
+// printed in the order they come (see FrameBuffer::StreamReader). A lock-free
+// ring buffer with a single writer and a single reader, which may be an
+// interrupt.
+//
+// The writer is given credit: free() rows can be pushed without any being
+// refused. A stream is live from Start() to End(); while live, running out of
+// rows is an underrun: the reader gets a blank row instead, and it is
+// counted. Rows still queued at End() are printed to the last, unless
+// dropped.
+//
+// The queue is sized in bytes, whatever the width of a row: as many rows as
+// fit, rounded down to a power of two. 8KiB hold 1024 rows of one panel.
+template <typename Row, size_t kBytes = 8 * 1024>
+class BasicRowStream {
+  static constexpr int RowsFitting() {
+    int rows = 1;
+    while (2 * rows * sizeof(Row) <= kBytes) rows *= 2;
+    return rows;
+  }
+  static constexpr int kRows = RowsFitting();
+
+ public:
+  static constexpr int kCapacity = kRows;
+
+  // New stream; counts underruns from zero. Rows still queued stay.
+  void Start() {
+    underruns_ = 0;
+    live_.store(true, std::memory_order_release);
+  }
+
+  // No more rows to come: printing ends once the queue is empty.
+  void End() { live_.store(false, std::memory_order_release); }
+
+  bool live() const { return live_.load(std::memory_order_acquire); }
+
+  // Forget the rows queued so far; the reader skips them with its next
+  // Pop(). Writer only.
+  void Drop() {
+    drop_to_.store(write_.load(std::memory_order_relaxed),
+                   std::memory_order_release);
+  }
+
+  // Append a row; false if there is no room. Writer only.
+  bool Push(const Row &row) {
+    const uint32_t write = write_.load(std::memory_order_relaxed);
+    if (write - read_.load(std::memory_order_acquire) >= kRows) return false;
+    rows_[write % kRows] = row;
+    write_.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Take the next row. If there is none, returns false and, while live,
+  // counts an underrun. Reader only.
+  bool Pop(Row *row) {
+    const uint32_t read = Unread();
+    if (read == write_.load(std::memory_order_acquire)) {
+      read_.store(read, std::memory_order_release);  // Past dropped rows.
+      if (live()) ++underruns_;
+      return false;
+    }
+    *row = rows_[read % kRows];
+    read_.store(read + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Rows to be read.
+  int queued() const {
+    return write_.load(std::memory_order_acquire) - Unread();
+  }
+
+  // Rows that can be pushed now: the credit of the writer. Dropped rows
+  // count until the reader skipped them.
+  int free() const {
+    return kRows - (write_.load(std::memory_order_acquire) -
+                    read_.load(std::memory_order_acquire));
+  }
+
+  // Rows the reader needed but did not get since Start().
+  uint32_t underruns() const { return underruns_; }
+
+ private:
+  // First row not read or dropped.
+  uint32_t Unread() const {
+    const uint32_t read = read_.load(std::memory_order_acquire);
+    const uint32_t drop = drop_to_.load(std::memory_order_acquire);
+    return static_cast<int32_t>(drop - read) > 0 ? drop : read;
+  }
+
+  Row rows_[kRows];
+  std::atomic<uint32_t> write_{0};
+  std::atomic<uint32_t> read_{0};
+  std::atomic<uint32_t> drop_to_{0};  // Rows before are dropped.
+  std::atomic<bool> live_{false};
+  volatile uint32_t underruns_ = 0;
+};
+
+#endif  // ROW_STREAM_H
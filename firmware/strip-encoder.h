@@ -1,16 +1,35 @@
 #ifndef STRIP_ENCODER_H
 #define STRIP_ENCODER_H
 
+#include <atomic>
 #include <cstdint>
 
 #include "hardware/gpio.h"
 #include "pico/time.h"
 
+// Encoder edges are captured in a GPIO interrupt with a timestamp and queued
+// in a lock-free ring buffer, so they are not lost if the main loop is busy
+// for a while. Poll() takes them out one at a time.
+//
+// With a single channel, each rising edge is a tick forward. In quadrature
+// mode, a second pick-up on the same strip pattern, a quarter line apart,
+// gives the direction: both edges of both channels are decoded to the tape
+// position in the interrupt, four steps per row, and each change of the row
+// position is a tick forward or back.
+//
+// Edges closer than kGlitchUsec to the tick before are glitches, e.g. a
+// pick-up bouncing at a line edge. With a single channel, they are dropped.
+// In quadrature mode, the state table still counts every transition, so a
+// bounce cancels out in the position; only the tick for a row change is held
+// back, and made up for by the next transition if the row still differs.
 class StripEncoder {
   static constexpr int kLEDPin = 13;  // On Feather board.
   static constexpr int kLineEncoderIn = 7;
+  static constexpr int kLineEncoderQuadratureIn = 6;  // Second channel.
   static constexpr int64_t kTimeoutUsec = 500'000;
   static constexpr int64_t kFastTickUsec = 7'000;
+  static constexpr int64_t kGlitchUsec = 300;  // Faster than any pull.
+  static constexpr uint32_t kEdgeQueueSize = 16;  // Power of two.
 
  public:
   enum class Result {
@@ -18,29 +37,59 @@ class StripEncoder {
     kNoTick,     // No change detected
     kFastTick,   // Tick since last seen, but was very fast.
     kTick,       // change since last
+    kBackTick,   // Tape pulled back a row; quadrature only.
   };
 
-  StripEncoder() {
+  explicit StripEncoder(bool quadrature = false) : quadrature_(quadrature) {
     gpio_init(kLineEncoderIn);
     gpio_set_dir(kLineEncoderIn, GPIO_IN);
 
     // Debug output.
     gpio_init(kLEDPin);
     gpio_set_dir(kLEDPin, GPIO_OUT);
+
+    instance_ = this;
+    if (quadrature_) {
+      gpio_init(kLineEncoderQuadratureIn);
+      gpio_set_dir(kLineEncoderQuadratureIn, GPIO_IN);
+      quadrature_state_ = QuadratureState();
+      constexpr uint32_t kBothEdges = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+      gpio_set_irq_enabled_with_callback(kLineEncoderIn, kBothEdges, true,
+                                         &EdgeInterrupt);
+      gpio_set_irq_enabled(kLineEncoderQuadratureIn, kBothEdges, true);
+    } else {
+      gpio_set_irq_enabled_with_callback(kLineEncoderIn, GPIO_IRQ_EDGE_RISE,
+                                         true, &EdgeInterrupt);
+    }
   }
 
   // Needs to be called regularly.
   Result Poll() {
-    const bool current_read = gpio_get(kLineEncoderIn);
-    const bool edge_detected = current_read && !last_read_;
-    last_read_ = current_read;
+    const uint32_t read_pos = edge_read_.load(std::memory_order_relaxed);
+    if (read_pos == edge_write_.load(std::memory_order_acquire)) {
+      return Result::kNoTick;
+    }
+    const Edge edge = edges_[read_pos % kEdgeQueueSize];
+    edge_read_.store(read_pos + 1, std::memory_order_release);
 
-    if (!edge_detected) return Result::kNoTick;
+    const int64_t usec_diff = absolute_time_diff_us(last_tick_time_, edge.time);
+    last_tick_time_ = edge.time;
+    const bool backwards = edge.position < position_;
+    position_ = edge.position;
 
-    const absolute_time_t this_tick_time = get_absolute_time();
-    const int64_t usec_diff =
-        absolute_time_diff_us(last_tick_time_, this_tick_time);
-    last_tick_time_ = this_tick_time;
+    if (usec_diff > kTimeoutUsec) {
+      tick_interval_usec_ = 0;  // Speed unknown after being idle.
+    } else if (tick_interval_usec_ == 0) {
+      tick_interval_usec_ = usec_diff;
+    } else {  // Exponential moving average, weighing last ~4 ticks.
+      tick_interval_usec_ += (usec_diff - tick_interval_usec_) / 4;
+    }
+
+    if (quadrature_) {  // Position is known, no need to be wary of fast ticks
+      gpio_put(kLEDPin, backwards);
+      if (usec_diff > kTimeoutUsec) return Result::kFirstTick;
+      return backwards ? Result::kBackTick : Result::kTick;
+    }
 
     if (usec_diff < kFastTickUsec) {
       gpio_put(kLEDPin, true);
@@ -53,8 +102,111 @@ class StripEncoder {
     return Result::kTick;
   }
 
+  // Called from the interrupt each time an edge was queued, e.g. to wake
+  // up the task calling Poll().
+  void set_edge_notify(void (*notify)()) { edge_notify_ = notify; }
+
+  // An edge is queued for the next Poll().
+  bool edge_pending() const {
+    return edge_read_.load(std::memory_order_relaxed) !=
+           edge_write_.load(std::memory_order_acquire);
+  }
+
+  // Tape position in rows at the tick last returned by Poll(). Counts
+  // ticks with a single channel.
+  int32_t position() const { return position_; }
+
+  // Smoothed time between ticks; inverse of the tape speed. Zero if not
+  // known yet, i.e. right after the first tick.
+  int32_t tick_interval_usec() const { return tick_interval_usec_; }
+
+  // Time of the edge last returned by Poll().
+  absolute_time_t last_tick_time() const { return last_tick_time_; }
+
+  // Edges lost because the queue was full.
+  uint32_t overruns() const { return overruns_; }
+
+  // Edges ignored because they came too quickly after the previous one.
+  uint32_t glitches() const { return glitches_; }
+
  private:
-  bool last_read_ = false;
+  struct Edge {
+    absolute_time_t time;
+    int32_t position;
+  };
+
+  static void EdgeInterrupt(uint gpio, uint32_t events) {
+    if (instance_->quadrature_) {
+      if (gpio == kLineEncoderIn || gpio == kLineEncoderQuadratureIn) {
+        instance_->QuadratureEdge(get_absolute_time());
+      }
+    } else if (gpio == kLineEncoderIn && (events & GPIO_IRQ_EDGE_RISE)) {
+      instance_->QueueEdge(get_absolute_time());
+    }
+  }
+
+  uint8_t QuadratureState() const {
+    return gpio_get(kLineEncoderIn) << 1 | gpio_get(kLineEncoderQuadratureIn);
+  }
+
+  // Called from interrupt. Steps of the gray code 00 -> 01 -> 11 -> 10 are
+  // forward, the other way back; both channels changing at once is ignored.
+  void QuadratureEdge(absolute_time_t now) {
+    static constexpr int8_t kStep[16] = {0,  1, -1, 0, -1, 0, 0, 1,
+                                         1,  0, 0, -1, 0, -1, 1, 0};
+    const uint8_t state = QuadratureState();
+    quadrature_count_ += kStep[quadrature_state_ << 2 | state];
+    quadrature_state_ = state;
+    const int32_t row = quadrature_count_ >> 2;  // Floor, also if negative.
+    if (row == edge_position_) return;
+    if (absolute_time_diff_us(last_edge_time_, now) < kGlitchUsec) {
+      ++glitches_;
+      return;
+    }
+    last_edge_time_ = now;
+    PushEdge(now, row);
+  }
+
+  // Called from interrupt.
+  void QueueEdge(absolute_time_t now) {
+    if (absolute_time_diff_us(last_edge_time_, now) < kGlitchUsec) {
+      ++glitches_;
+      return;
+    }
+    last_edge_time_ = now;
+    PushEdge(now, edge_position_ + 1);
+  }
+
+  // Called from interrupt: the only writer of edge_write_.
+  void PushEdge(absolute_time_t now, int32_t position) {
+    const uint32_t write_pos = edge_write_.load(std::memory_order_relaxed);
+    if (write_pos - edge_read_.load(std::memory_order_acquire) >=
+        kEdgeQueueSize) {
+      ++overruns_;
+      return;
+    }
+    edge_position_ = position;
+    edges_[write_pos % kEdgeQueueSize] = {now, position};
+    edge_write_.store(write_pos + 1, std::memory_order_release);
+    if (edge_notify_) edge_notify_();
+  }
+
+  static inline StripEncoder *instance_ = nullptr;  // For the interrupt.
+
+  const bool quadrature_;
+  Edge edges_[kEdgeQueueSize];
+  std::atomic<uint32_t> edge_write_{0};
+  std::atomic<uint32_t> edge_read_{0};
+  absolute_time_t last_edge_time_{};
+  volatile uint32_t overruns_ = 0;
+  volatile uint32_t glitches_ = 0;
+  void (*edge_notify_)() = nullptr;
+  int32_t edge_position_ = 0;  // Position of the last queued edge.
+  int32_t quadrature_count_ = 0;  // Quarter rows.
+  uint8_t quadrature_state_ = 0;
+
   absolute_time_t last_tick_time_{};
+  int32_t position_ = 0;
+  int32_t tick_interval_usec_ = 0;
 };
 #endif
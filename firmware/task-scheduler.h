@@ -0,0 +1,128 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+
+#include "pico/time.h"
+
+// Main loop work split into tasks of strict priority, task 0 first. A task
+// runs when an event was posted for it, from an interrupt or another task,
+// or when its period is due. RunNext() runs the highest priority one and
+// returns, so work for a task is never waiting behind more than a single
+// run of a lower priority task. Tasks that take long check Preempted() to
+// return early.
+//
+// Each run is timed against the budget of the task. Runs over budget are
+// counted and the longest is kept, as well as the longest wait from event
+// to run; PrintStats() shows them.
+template <int kTasks>
+class TaskScheduler {
+  static_assert(kTasks < 32, "One event bit per task");
+
+ public:
+  struct Task {
+    const char *name;
+    uint32_t budget_usec;
+    uint32_t period_usec;  // Run at least this often; 0: only on events.
+    std::function<void()> run;
+  };
+
+  // Tasks by priority, highest first.
+  explicit TaskScheduler(const Task (&tasks)[kTasks]) {
+    const uint32_t now = Now();
+    for (int t = 0; t < kTasks; ++t) {
+      tasks_[t] = tasks[t];
+      due_usec_[t] = now + tasks[t].period_usec;
+    }
+  }
+
+  // Task has work. Also from an interrupt on the core running the tasks.
+  void Post(int task) {
+    const uint32_t bit = 1u << task;
+    if (!(pending_.load(std::memory_order_relaxed) & bit)) {
+      posted_usec_[task] = Now();
+    }
+    pending_.fetch_or(bit, std::memory_order_release);
+  }
+
+  // An event is waiting for any task.
+  bool Pending() const { return pending_.load(std::memory_order_acquire); }
+
+  // An event is waiting for a task of higher priority than the one running.
+  bool Preempted() const {
+    return pending_.load(std::memory_order_acquire) & ((1u << running_) - 1);
+  }
+
+  // Run the highest priority task with an event or due. Returns false if
+  // there was none.
+  bool RunNext() {
+    const uint32_t now = Now();
+    const uint32_t pending = pending_.load(std::memory_order_acquire);
+    for (int t = 0; t < kTasks; ++t) {
+      const uint32_t bit = 1u << t;
+      const bool due = tasks_[t].period_usec > 0 &&
+                       static_cast<int32_t>(now - due_usec_[t]) >= 0;
+      if (!(pending & bit) && !due) continue;
+      pending_.fetch_and(~bit, std::memory_order_acq_rel);
+      Stats &s = stats_[t];
+      const uint32_t since = (pending & bit) ? posted_usec_[t] : due_usec_[t];
+      if (now - since > s.max_wait_usec) s.max_wait_usec = now - since;
+      if (tasks_[t].period_usec > 0) due_usec_[t] = now + tasks_[t].period_usec;
+
+      running_ = t;
+      tasks_[t].run();
+      running_ = kTasks;
+      const uint32_t usec = Now() - now;
+      ++s.runs;
+      if (usec > tasks_[t].budget_usec) ++s.over_budget;
+      if (usec > s.max_usec) s.max_usec = usec;
+      return true;
+    }
+    return false;
+  }
+
+  // Time until the next task is due by its period.
+  uint32_t UsecUntilDue() const {
+    const uint32_t now = Now();
+    int32_t until = INT32_MAX;
+    for (int t = 0; t < kTasks; ++t) {
+      if (tasks_[t].period_usec == 0) continue;
+      const int32_t left = static_cast<int32_t>(due_usec_[t] - now);
+      if (left < until) until = left;
+    }
+    return until > 0 ? until : 0;
+  }
+
+  void PrintStats() const {
+    printf("%-8s %8s %6s %8s %8s %8s\n", "task", "runs", "over", "budget",
+           "max-us", "wait-us");
+    for (int t = 0; t < kTasks; ++t) {
+      const Stats &s = stats_[t];
+      printf("%-8s %8u %6u %8u %8u %8u\n", tasks_[t].name, (unsigned)s.runs,
+             (unsigned)s.over_budget, (unsigned)tasks_[t].budget_usec,
+             (unsigned)s.max_usec, (unsigned)s.max_wait_usec);
+    }
+  }
+
+ private:
+  struct Stats {
+    uint32_t runs;
+    uint32_t over_budget;
+    uint32_t max_usec;
+    uint32_t max_wait_usec;  // From event or due time to run.
+  };
+
+  static uint32_t Now() { return to_us_since_boot(get_absolute_time()); }
+
+  Task tasks_[kTasks];
+  uint32_t due_usec_[kTasks];
+  volatile uint32_t posted_usec_[kTasks] = {};
+  std::atomic<uint32_t> pending_{0};
+  int running_ = kTasks;
+  Stats stats_[kTasks] = {};
+};
+
+#endif  // TASK_SCHEDULER_H
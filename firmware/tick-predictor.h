@@ -0,0 +1,85 @@
+#ifndef TICK_PREDICTOR_H
+#define TICK_PREDICTOR_H
+
+#include <cstdint>
+
+#include "pico/time.h"
+
+// When the next encoder edge is due, tracked over the edges of a pull with
+// an alpha-beta filter: each edge corrects the estimated time of the edge
+// and the time between edges by a fraction of how far off the prediction
+// was. With that, the row for the next edge can be made ready and flashed
+// right when the tape reaches it, instead of once the edge was noticed, and
+// rows can be placed in between edges. How far off edges were lately tells
+// whether the speed is steady.
+//
+// The first interval gives the speed; the filter is locked once an edge
+// comes within a quarter row of where it was expected, at the earliest the
+// third edge of a pull. An edge off by more than half a row loses the lock:
+// the speed is taken from the last interval again, to lock anew.
+class TickPredictor {
+  // Gains as shifts: alpha 1/2, beta 1/8; about critically damped.
+  static constexpr int kAlphaShift = 1;
+  static constexpr int kBetaShift = 3;
+  static constexpr int kFractionBits = 4;  // Of the interval, in usec.
+
+ public:
+  // Edges of a pull before the first that can be locked on.
+  static constexpr int kLeadEdges = 2;
+
+  // First edge of a pull; speed unknown.
+  void Start(absolute_time_t edge) {
+    edge_usec_ = to_us_since_boot(edge);
+    interval_ = 0;
+    locked_ = false;
+  }
+
+  // Next edge. Returns false if it came too soon after the one before to
+  // be the next line while locked: a glitch, to be ignored.
+  bool Edge(absolute_time_t edge) {
+    const int64_t usec = to_us_since_boot(edge);
+    const int64_t since = usec - edge_usec_;
+    const int32_t interval = interval_usec();
+    if (locked_ && since < interval / 4) return false;
+    const int64_t error = since - interval;
+    const int64_t off = error < 0 ? -error : error;
+    if (interval == 0 || off > interval / (locked_ ? 2 : 4)) {
+      locked_ = false;  // Start over from this interval.
+      edge_usec_ = usec;
+      interval_ = static_cast<int32_t>(since) << kFractionBits;
+      // Not steady until edges came close for a while after locking on.
+      deviation_usec_ = static_cast<int32_t>(since) / 4;
+      return true;
+    }
+    locked_ = true;
+    edge_usec_ += interval + (error >> kAlphaShift);
+    interval_ += (error << kFractionBits) >> kBetaShift;
+    deviation_usec_ += (static_cast<int32_t>(off) - deviation_usec_) / 8;
+    return true;
+  }
+
+  // Predictions are good.
+  bool locked() const { return locked_; }
+
+  // Locked, and edges came within a sixteenth row of the predictions on
+  // average lately: e.g. not speeding up much.
+  bool steady() const {
+    return locked_ && deviation_usec_ < interval_usec() / 16;
+  }
+
+  // Estimated time between edges; zero if not known yet.
+  int32_t interval_usec() const { return interval_ >> kFractionBits; }
+
+  // Predicted time halfway to the next edge.
+  absolute_time_t half_row() const {
+    return from_us_since_boot(edge_usec_ + interval_usec() / 2);
+  }
+
+ private:
+  int64_t edge_usec_ = 0;  // Estimated time of the last edge.
+  int32_t interval_ = 0;   // Estimated time between edges, fixed point.
+  int32_t deviation_usec_ = 0;  // Average error of predictions.
+  bool locked_ = false;
+};
+
+#endif  // TICK_PREDICTOR_H
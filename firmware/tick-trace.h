@@ -0,0 +1,231 @@
+#ifndef TICK_TRACE_H
+#define TICK_TRACE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "frame-printer.h"
+#include "pico/time.h"
+#include "strip-encoder.h"
+
+// Timing of the last kTicks encoder ticks in a RAM ring buffer, to see what
+// happens in the main loop during a real pull: edge time, what the encoder
+// made of it, how long SendNext() took and when and how long the LEDs
+// flashed; flashes set up ahead of the edge may start before it. Dump()
+// prints the raw records, PrintStats() a summary.
+//
+// With kTicks = 0, all methods are empty and the instrumentation compiles
+// out entirely.
+template <size_t kTicks>
+class TickTrace {
+ public:
+  // Time in microseconds for Sent(); only read if tracing.
+  uint32_t Now() const {
+    if constexpr (kTicks > 0) return to_us_since_boot(get_absolute_time());
+    return 0;
+  }
+
+  // Start record of a new tick as just returned by encoder.Poll().
+  void Tick(const StripEncoder &encoder, StripEncoder::Result result) {
+    if constexpr (kTicks > 0) {
+      Record &r = records_[count_++ % kTicks];
+      r = {};
+      r.edge_us = to_us_since_boot(encoder.last_tick_time());
+      r.result = static_cast<uint8_t>(result);
+      overruns_ = encoder.overruns();
+      glitches_ = encoder.glitches();
+    }
+  }
+
+  // Tick not printed: predictor not locked yet, or a glitch.
+  void Skipped() {
+    if constexpr (kTicks > 0) current().flags |= kSkipped;
+  }
+
+  // SendNext() started at start_us returned more. The flash before is over
+  // now, so its actual length is known.
+  void Sent(uint32_t start_us, bool more, const FramePrinter &printer) {
+    if constexpr (kTicks > 0) {
+      Record &r = current();
+      r.send_us = Now() - start_us;
+      if (more) r.flags |= kSent;
+      FlashOver(printer);
+    }
+  }
+
+  // Flash of the row for this tick started, for usec.
+  void Flash(const FramePrinter &printer, uint32_t usec) {
+    if constexpr (kTicks > 0) {
+      Record &r = current();
+      const int64_t latency =
+          to_us_since_boot(printer.flash_start_time()) - r.edge_us;
+      r.latency_us = std::clamp<int64_t>(latency, INT16_MIN, INT16_MAX);
+      r.flash_us = usec;
+      r.flags |= kFlashed;
+    }
+  }
+
+  // Half row set up to flash after the row of this tick, which is over.
+  void HalfRow(const FramePrinter &printer) {
+    if constexpr (kTicks > 0) {
+      current().flags |= kHalfRow;
+      FlashOver(printer);
+    }
+  }
+
+  void Clear() { count_ = 0; }
+
+  // One line per tick, oldest first.
+  void Dump() const {
+    if constexpr (kTicks > 0) {
+      printf("\n%10s %6s %8s %7s %5s %5s %5s %s\n", "edge-us", "tick",
+             "interval", "latency", "send", "flash", "lit", "flags");
+      for (uint32_t i = first(); i < count_; ++i) {
+        const Record &r = records_[i % kTicks];
+        printf("%10u %6s %8u %7d %5u %5u %5u %s%s%s%s\n", (unsigned)r.edge_us,
+               kResultName[r.result], (unsigned)Interval(i), r.latency_us,
+               (unsigned)r.send_us, (unsigned)r.flash_us, (unsigned)r.lit_us,
+               (r.flags & kSkipped) ? "skipped " : "",
+               (r.flags & kFlashed) ? "flashed " : "",
+               (r.flags & kHalfRow) ? "half " : "",
+               Truncated(r) ? "truncated" : "");
+      }
+    } else {
+      printf("\nTrace not compiled in.\n");
+    }
+  }
+
+  // Counts, histogram of tick intervals and percentiles of latency and
+  // SendNext() time.
+  void PrintStats() const {
+    if constexpr (kTicks > 0) {
+      if (count_ == 0) {
+        printf("\nNo ticks yet.\n");
+        return;
+      }
+      int results[5] = {};
+      int skipped = 0, flashed = 0, halves = 0, truncated = 0;
+      int histogram[kIntervalBuckets] = {};
+      for (uint32_t i = first(); i < count_; ++i) {
+        const Record &r = records_[i % kTicks];
+        ++results[r.result];
+        skipped += (r.flags & kSkipped) != 0;
+        flashed += (r.flags & kFlashed) != 0;
+        halves += (r.flags & kHalfRow) != 0;
+        truncated += Truncated(r);
+        if (i > first()) ++histogram[IntervalBucket(Interval(i))];
+      }
+      printf("\nticks: %u (first %d, fast %d, back %d)\n",
+             (unsigned)(count_ - first()),
+             results[(int)StripEncoder::Result::kFirstTick],
+             results[(int)StripEncoder::Result::kFastTick],
+             results[(int)StripEncoder::Result::kBackTick]);
+      printf("flashed: %d, half rows: %d, skipped: %d, truncated: %d\n",
+             flashed, halves, skipped, truncated);
+      printf("encoder overruns: %u, glitches: %u\n", (unsigned)overruns_,
+             (unsigned)glitches_);
+      printf("tick interval:\n");
+      for (int b = 0; b < kIntervalBuckets; ++b) {
+        if (b + 1 < kIntervalBuckets) {
+          printf(" <%4d ms %5d ", 1 << b, histogram[b]);
+        } else {
+          printf(">=%4d ms %5d ", 1 << (b - 1), histogram[b]);
+        }
+        const int bar = histogram[b] * 40 / static_cast<int>(count_ - first());
+        for (int i = 0; i < bar; ++i) {
+          putchar('#');
+        }
+        putchar('\n');
+      }
+      PrintPercentiles("latency us", &Record::latency_us, kFlashed);
+      PrintPercentiles("send us", &Record::send_us, kSent);
+    } else {
+      printf("\nTrace not compiled in.\n");
+    }
+  }
+
+ private:
+  enum Flags : uint8_t {
+    kSkipped = 1 << 0,
+    kSent = 1 << 1,  // SendNext() had a row.
+    kFlashed = 1 << 2,
+    kHalfRow = 1 << 3,  // Followed by a half row.
+  };
+
+  struct Record {
+    uint32_t edge_us;
+    int16_t latency_us;   // Edge to start of flash; negative if before.
+    uint16_t send_us;     // Time in SendNext().
+    uint16_t flash_us;    // Flash time asked for.
+    uint16_t lit_us;      // Flash time until it actually ended.
+    uint8_t result;       // StripEncoder::Result
+    uint8_t flags;
+  };
+
+  static constexpr int kIntervalBuckets = 10;  // <1ms, <2ms ... >=256ms
+  static constexpr const char *kResultName[] = {"first", "none", "fast",
+                                                "tick", "back"};
+
+  Record &current() { return records_[(count_ - 1) % kTicks]; }
+  uint32_t first() const { return count_ > kTicks ? count_ - kTicks : 0; }
+
+  uint32_t Interval(uint32_t i) const {
+    if (i == first()) return 0;
+    return records_[i % kTicks].edge_us - records_[(i - 1) % kTicks].edge_us;
+  }
+
+  static int IntervalBucket(uint32_t usec) {
+    int bucket = 0;
+    for (uint32_t ms = usec / 1000; ms > 0 && bucket < kIntervalBuckets - 1;
+         ms >>= 1) {
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  // The flash started last is over, unless the next one started already:
+  // the actual length of that of a recent tick.
+  void FlashOver(const FramePrinter &printer) {
+    if (printer.flash_active()) return;
+    const uint32_t start_us = to_us_since_boot(printer.flash_start_time());
+    const uint32_t end_us = to_us_since_boot(printer.flash_end_time());
+    for (uint32_t i = count_; i > first() && i + 2 > count_; --i) {
+      Record &r = records_[(i - 1) % kTicks];
+      if ((r.flags & kFlashed) && r.edge_us + r.latency_us == start_us) {
+        if (end_us >= start_us) r.lit_us = end_us - start_us;
+        return;
+      }
+    }
+  }
+
+  // Flash ended by the next tick before its time; a bit of slack for the
+  // time it takes to switch off.
+  static bool Truncated(const Record &r) {
+    return (r.flags & kFlashed) && r.lit_us > 0 && r.lit_us + 5 < r.flash_us;
+  }
+
+  template <typename T>
+  void PrintPercentiles(const char *name, T Record::*field,
+                        uint8_t flag) const {
+    static int32_t values[kTicks];
+    size_t n = 0;
+    for (uint32_t i = first(); i < count_; ++i) {
+      const Record &r = records_[i % kTicks];
+      if (r.flags & flag) values[n++] = r.*field;
+    }
+    if (n == 0) return;
+    std::sort(values, values + n);
+    printf("%-11s p50 %5d  p90 %5d  p99 %5d  max %5d\n", name,
+           (int)values[n / 2], (int)values[n * 9 / 10],
+           (int)values[n * 99 / 100], (int)values[n - 1]);
+  }
+
+  Record records_[kTicks > 0 ? kTicks : 1];
+  uint32_t count_ = 0;  // Ticks recorded since Clear().
+  uint32_t overruns_ = 0;
+  uint32_t glitches_ = 0;
+};
+
+#endif  // TICK_TRACE_H
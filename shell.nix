@@ -17,7 +17,8 @@ let
     installPhase = "mkdir -p $out/bin; install gcode-cli $out/bin";
   };
 
-  # Generating compressed fonts from BDF for use in embedded device.
+  # The font generator used before make-glyph-font.py; only to check that
+  # the glyphs stay the same (make -C firmware/host check-fonts).
   bdfont-data = pkgs.stdenv.mkDerivation rec {
     name = "bdfont-data";
     src = pkgs.fetchFromGitHub {
@@ -38,11 +39,11 @@ pkgs.mkShell {
       gcc-arm-embedded
       local-pico-sdk
       picotool
-      cmake python3   # build requirements for pico-sdk
+      cmake python3   # build requirements for pico-sdk and fonts
 
       # Tools needed
-      bdfont-data   # Generated embedded fonts
       gcode-cli     # Tool to sync time from host to glowtape
+      bdfont-data   # Check of the generated fonts
 
       # Generating casing and sync-tape
       openscad-unstable
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+"""Upload an image to glowtape over USB serial.
+
+The image is a PBM file (netpbm P1 or P4), at most 64 pixels wide, or 64
+for each panel of firmware built with GLOWTAPE_PANELS; each pixel row
+becomes one row on the tape. Images are kept in flash by name;
+uploading with the same name replaces an image. Press the button five times
+to print the first stored image, six times for the second and so on.
+
+With -s, the rows are not stored but streamed: printed as they arrive
+while the tape is pulled, e.g. for a long ticker. The firmware queues rows
+ahead; they are sent as fast as its queue has room for them. Rows the tape
+needs before they arrive are printed blank and counted. Ctrl-C stops the
+stream and drops the rows queued.
+
+Uses the binary packet protocol in firmware/packet-reader.h: COBS encoded
+packets framed by zero bytes, CRC-16, one ack per packet. Time is still set
+with set-time.sh.
+
+Usage: upload-image.py [-n name] [-p panels] image.pbm [/dev/ttyACM0]
+       upload-image.py -s [-p panels] image.pbm [/dev/ttyACM0]  # stream
+       upload-image.py -d name [/dev/ttyACM0]    # delete image
+"""
+
+import getopt
+import os
+import random
+import sys
+import termios
+import time
+
+PACKET_ROW_WORDS = 64  # kMaxUploadRowsPerPacket in glowtape.cc, per panel.
+ACK_TIMEOUT_SEC = 1.0
+RETRIES = 5
+BUSY_RETRY_SEC = 0.2   # Flash still busy storing the previous image.
+NAME_SIZE = 15         # FlashStore::kNameSize without terminating nul.
+CREDIT_POLL_SEC = 0.05  # Streaming: no room in the queue, ask again.
+
+STATUS = {0: "ok", 1: "bad packet", 2: "unknown type", 3: "out of space",
+          4: "out of order", 5: "busy", 6: "not found"}
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE"""
+    crc = 0xffff
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+            continue
+        block.append(b)
+        if len(block) == 254:
+            out += b"\xff" + block
+            block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def read_pbm(filename, panels):
+    """Returns list of rows, each a list of booleans."""
+    with open(filename, "rb") as f:
+        content = f.read()
+    tokens = []
+    pos = 0
+    while len(tokens) < 3:  # magic, width, height
+        while content[pos:pos + 1].isspace():
+            pos += 1
+        if content[pos:pos + 1] == b"#":
+            pos = content.index(b"\n", pos)
+            continue
+        start = pos
+        while not content[pos:pos + 1].isspace():
+            pos += 1
+        tokens.append(content[start:pos])
+    magic, width, height = tokens[0], int(tokens[1]), int(tokens[2])
+    if width > 64 * panels:
+        sys.exit("Image is %d pixels wide; at most %d fit" %
+                 (width, 64 * panels))
+    rows = []
+    if magic == b"P4":
+        pos += 1  # Single whitespace before raster.
+        stride = (width + 7) // 8
+        for y in range(height):
+            line = content[pos + y * stride:pos + (y + 1) * stride]
+            rows.append([bool(line[x // 8] & (0x80 >> (x % 8)))
+                         for x in range(width)])
+    elif magic == b"P1":
+        bits = [c == ord("1") for c in content[pos:] if c in b"01"]
+        rows = [bits[y * width:(y + 1) * width] for y in range(height)]
+    else:
+        sys.exit("Only PBM images (P1 or P4) supported")
+    return rows
+
+
+def row_bytes(pixels, panels):
+    """Row as sent: 64 bit little endian per panel, leftmost panel first;
+    the leftmost pixel of a panel is bit 63."""
+    words = [0] * panels
+    for x, on in enumerate(pixels):
+        if on:
+            words[x // 64] |= 1 << (63 - x % 64)
+    return b"".join(w.to_bytes(8, "little") for w in words)
+
+
+class Connection:
+    def __init__(self, device):
+        self.device = device
+        self.fd = os.open(device, os.O_RDWR | os.O_NOCTTY)
+        attr = termios.tcgetattr(self.fd)
+        attr[0] = 0                           # iflag: no translation.
+        attr[1] = 0                           # oflag
+        attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attr[3] = 0                           # lflag: raw, no echo.
+        attr[6][termios.VMIN] = 0
+        attr[6][termios.VTIME] = 1
+        termios.tcsetattr(self.fd, termios.TCSANOW, attr)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        # The firmware skips a packet with the type and seq of the one before
+        # as resent; don't start where the last run might have stopped.
+        self.seq = random.randrange(256)
+        self.pending = bytearray()
+
+    def read_ack(self, deadline):
+        """Next ack packet; skips text output in between. None on timeout."""
+        while time.monotonic() < deadline:
+            self.pending += os.read(self.fd, 256)
+            while True:
+                start = self.pending.find(0)
+                end = self.pending.find(0, start + 1)
+                if start < 0 or end < 0:
+                    break
+                frame = bytes(self.pending[start + 1:end])
+                if not frame:  # Two zeros: second one is the start.
+                    del self.pending[:start + 1]
+                    continue
+                del self.pending[:end + 1]
+                packet = cobs_decode(frame)
+                if (len(packet) >= 5 and packet[0] == ord("A") and
+                        crc16(packet[:-2]) == packet[-2] << 8 | packet[-1]):
+                    return packet[1], packet[2], packet[3:-2]
+        return None
+
+    def send(self, packet_type, data=b""):
+        """Send packet, wait for ack. Returns reply data."""
+        self.seq = (self.seq + 1) % 256
+        payload = bytes([ord(packet_type), self.seq]) + data
+        crc = crc16(payload)
+        packet = b"\0" + cobs_encode(payload + bytes([crc >> 8, crc & 0xff]))
+        packet += b"\0"
+        attempt = 0
+        while attempt < RETRIES:
+            attempt += 1
+            os.write(self.fd, packet)
+            while True:
+                ack = self.read_ack(time.monotonic() + ACK_TIMEOUT_SEC)
+                if ack is None or ack[0] == self.seq:
+                    break  # Stale acks of earlier attempts are skipped.
+            if ack is None or ack[1] == 1:
+                continue  # Lost or damaged on the way; resend.
+            if ack[1] == 5:
+                time.sleep(BUSY_RETRY_SEC)
+                attempt = 0
+                continue
+            if ack[1] != 0:
+                sys.exit("Upload failed: %s" % STATUS.get(ack[1], ack[1]))
+            return ack[2]
+        sys.exit("No response from %s" % self.device)
+
+
+def stream(connection, rows, panels):
+    """Send rows to print as the tape is pulled, as many at a time as the
+    reply to the packet before says there is room for."""
+    rows_per_packet = PACKET_ROW_WORDS // panels
+    reply = connection.send("S")  # No rows: just asks for room.
+    sent = 0
+    start = time.monotonic()
+    try:
+        while sent < len(rows):
+            free = reply[0] | reply[1] << 8
+            count = min(free, rows_per_packet, len(rows) - sent)
+            if count == 0:
+                time.sleep(CREDIT_POLL_SEC)
+            data = b"".join(row_bytes(r, panels)
+                            for r in rows[sent:sent + count])
+            reply = connection.send("S", data)
+            sent += count
+        reply = connection.send("Q")
+    except KeyboardInterrupt:
+        reply = connection.send("Q", b"\1")  # Drop what is still queued.
+    duration = time.monotonic() - start
+    underruns = reply[2] | reply[3] << 8
+    print("Streamed %d rows (%.1f cm) in %.2fs, %d underruns" %
+          (sent, sent * 0.08, duration, underruns))
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "n:d:p:s")
+    except getopt.GetoptError:
+        sys.exit(__doc__)
+    opts = dict(opts)
+    if "-d" in opts:
+        if len(args) > 1:
+            sys.exit(__doc__)
+        connection = Connection(args[0] if args else "/dev/ttyACM0")
+        connection.send("D", opts["-d"][:NAME_SIZE].encode())
+        print("Deleted %s" % opts["-d"])
+        return
+    if not args or len(args) > 2:
+        sys.exit(__doc__)
+    panels = int(opts.get("-p", 1))
+    if not 1 <= panels <= 4:
+        sys.exit("Panels must be 1 to 4")
+    rows = read_pbm(args[0], panels)
+    rows_per_packet = PACKET_ROW_WORDS // panels
+    name = opts.get("-n", os.path.splitext(os.path.basename(args[0]))[0])
+    connection = Connection(args[1] if len(args) > 1 else "/dev/ttyACM0")
+    if "-s" in opts:
+        stream(connection, rows, panels)
+        return
+
+    start = time.monotonic()
+    connection.send("B", name[:NAME_SIZE].encode())
+    for i in range(0, len(rows), rows_per_packet):
+        chunk = rows[i:i + rows_per_packet]
+        connection.send("R", b"".join(row_bytes(r, panels) for r in chunk))
+    reply = connection.send("E")
+    duration = time.monotonic() - start
+    received = reply[0] | reply[1] << 8
+    print("Uploaded '%s', %d rows (%.1f cm) in %.2fs, %.0f bytes/s" %
+          (name[:NAME_SIZE], received, received * 0.08, duration,
+           8 * panels * len(rows) / duration))
+
+
+if __name__ == "__main__":
+    main()